@@ -3,14 +3,7 @@
 #include "album_art.h"
 #include "error_handling.h"
 
-void extract_album_art(FILE *file, unsigned int frame_size, char *img_file_name){
-    // Allocate memory to store the APIC frame content
-    char *apic_content = (char *)calloc(1, frame_size);
-    if (!apic_content) {
-        perror("Memory allocation failed");
-        return;
-    }
-    
+void extract_album_art(const unsigned char *apic_content, unsigned int frame_size, char *img_file_name){
     /*
      * APIC frame format in ID3v2:
      * ---------------------------------------------------------
@@ -23,27 +16,32 @@ void extract_album_art(FILE *file, unsigned int frame_size, char *img_file_name)
     */
 
     // Skip the text encoding byte
-    fseek(file, 1, SEEK_CUR);
-
-    fread(apic_content, frame_size - 1, 1, file);
-    int idx = 0;
+    unsigned int idx = 1;
 
     // Get the image format
-    unsigned char image_format[20];
+    char image_format[20];
     unsigned int image_format_len = 0;
 
-    while(apic_content[idx] != '\0'){
-        image_format[image_format_len++] = apic_content[idx++];
+    while(idx < frame_size && apic_content[idx] != '\0'){
+        if(image_format_len < sizeof(image_format) - 1){
+            image_format[image_format_len++] = apic_content[idx];
+        }
+        idx++;
     }
     image_format[image_format_len] = '\0';
     idx += 2; // Skip the null byte after the image format string and the picture type byte
 
     // Skip the image description string
-    while(apic_content[idx] != '\0'){
+    while(idx < frame_size && apic_content[idx] != '\0'){
         idx++;
     }
     idx++; // Skip the null byte after the description string
 
+    if(idx > frame_size){
+        display_error("Malformed album art frame.");
+        return;
+    }
+
     char *extension = strcmp(image_format, "image/png") ? "jpg" : "png";
 
     sprintf(img_file_name, "album_art.%s", extension);
@@ -58,5 +56,4 @@ void extract_album_art(FILE *file, unsigned int frame_size, char *img_file_name)
     fwrite(&apic_content[idx], frame_size - idx, 1, img_file);
 
     fclose(img_file);
-    free(apic_content);
-}
\ No newline at end of file
+}
@@ -4,8 +4,8 @@
 #include "id3_utils.h"
 
 /**
- * @brief Extracts the album art from the MP3 file
+ * @brief Extracts the album art from the content of an APIC frame
  */
-void extract_album_art(FILE *, unsigned int, char *);
+void extract_album_art(const unsigned char *, unsigned int, char *);
 
 #endif
\ No newline at end of file
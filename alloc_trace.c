@@ -0,0 +1,388 @@
+/**
+ * @file alloc_trace.c
+ * @brief Counting allocation hooks used by the allocation tracing build mode.
+ */
+#define ALLOC_TRACE_IMPLEMENTATION
+#include "main.h"
+#include "alloc_trace.h"
+#include "error_handling.h"
+
+#ifdef ALLOC_TRACE
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define TRACE_SITE_SLOTS 1024
+#define TRACE_POINTER_BUCKETS 65536
+
+/**
+ * @brief Allocation statistics of one call site.
+ */
+typedef struct {
+    const char *file;          /**< Source file, NULL marks an empty slot */
+    int line;                  /**< Source line */
+    size_t calls;              /**< Number of allocations */
+    unsigned long long bytes;  /**< Bytes requested */
+    long long live;            /**< Bytes currently allocated */
+} TraceSite;
+
+/**
+ * @brief A live traced allocation.
+ */
+typedef struct TracePointer {
+    void *pointer;              /**< Address returned to the caller */
+    size_t size;                /**< Requested size */
+    TraceSite *site;            /**< Site that allocated it */
+    struct TracePointer *next;  /**< Next pointer in the bucket */
+} TracePointer;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceSite trace_sites[TRACE_SITE_SLOTS];
+static TraceSite overflow_site = {"(other)", 0, 0, 0, 0};
+static TracePointer *trace_pointers[TRACE_POINTER_BUCKETS];
+static size_t total_calls;
+static unsigned long long total_bytes;
+static unsigned long long live_bytes;
+static unsigned long long peak_bytes;
+
+/**
+ * @brief Returns the statistics slot of a call site, creating it if needed.
+ */
+static TraceSite *find_site(const char *file, int line){
+    size_t hash = (((size_t)file >> 4) * 31 + (size_t)line) * 2654435761u;
+
+    for(size_t probe = 0; probe < TRACE_SITE_SLOTS; probe++){
+        TraceSite *site = &trace_sites[(hash + probe) % TRACE_SITE_SLOTS];
+        if(!site->file){
+            site->file = file;
+            site->line = line;
+            return site;
+        }
+        if(site->line == line && (site->file == file || strcmp(site->file, file) == 0)){
+            return site;
+        }
+    }
+
+    return &overflow_site;
+}
+
+/**
+ * @brief Returns the bucket of a pointer in the live allocation map.
+ */
+static TracePointer **pointer_bucket(const void *pointer){
+    return &trace_pointers[((size_t)pointer >> 4) % TRACE_POINTER_BUCKETS];
+}
+
+/**
+ * @brief Records a successful allocation.
+ */
+static void record_allocation(void *pointer, size_t size, const char *file, int line){
+    TracePointer *entry = (TracePointer *)malloc(sizeof(TracePointer));
+
+    pthread_mutex_lock(&trace_lock);
+
+    TraceSite *site = find_site(file, line);
+    site->calls++;
+    site->bytes += size;
+    total_calls++;
+    total_bytes += size;
+
+    // Without an entry the allocation is still counted but never shows as live
+    if(entry){
+        TracePointer **bucket = pointer_bucket(pointer);
+        entry->pointer = pointer;
+        entry->size = size;
+        entry->site = site;
+        entry->next = *bucket;
+        *bucket = entry;
+
+        site->live += size;
+        live_bytes += size;
+        if(live_bytes > peak_bytes){
+            peak_bytes = live_bytes;
+        }
+    }
+
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * @brief Takes a traced pointer out of the live allocation map.
+ *
+ * Pointers allocated by libc are not in the map and are ignored.
+ *
+ * @return The entry of the pointer, NULL if it wasn't traced.
+ */
+static TracePointer *take_allocation(void *pointer){
+    TracePointer *entry = NULL;
+
+    pthread_mutex_lock(&trace_lock);
+
+    for(TracePointer **link = pointer_bucket(pointer); *link; link = &(*link)->next){
+        if((*link)->pointer == pointer){
+            entry = *link;
+            *link = entry->next;
+            entry->site->live -= entry->size;
+            live_bytes -= entry->size;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&trace_lock);
+
+    return entry;
+}
+
+/**
+ * @brief Puts back an entry taken out of the live allocation map.
+ */
+static void restore_allocation(TracePointer *entry){
+    pthread_mutex_lock(&trace_lock);
+
+    TracePointer **bucket = pointer_bucket(entry->pointer);
+    entry->next = *bucket;
+    *bucket = entry;
+    entry->site->live += entry->size;
+    live_bytes += entry->size;
+
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * @brief Removes a traced pointer from the live allocation map.
+ */
+static void forget_allocation(void *pointer){
+    free(take_allocation(pointer));
+}
+
+void *trace_malloc(size_t size, const char *file, int line){
+    void *pointer = malloc(size);
+    if(pointer){
+        record_allocation(pointer, size, file, line);
+    }
+
+    return pointer;
+}
+
+void *trace_calloc(size_t count, size_t size, const char *file, int line){
+    void *pointer = calloc(count, size);
+    if(pointer){
+        record_allocation(pointer, count * size, file, line);
+    }
+
+    return pointer;
+}
+
+void *trace_realloc(void *old_pointer, size_t size, const char *file, int line){
+    // The old entry goes first: once realloc has released the block, malloc may hand its address to another thread
+    TracePointer *old_entry = old_pointer ? take_allocation(old_pointer) : NULL;
+
+    void *pointer = realloc(old_pointer, size);
+    if(pointer){
+        free(old_entry);
+        record_allocation(pointer, size, file, line);
+    }
+    else if(old_entry && size != 0){
+        // The old block is still allocated
+        restore_allocation(old_entry);
+    }
+    else{
+        free(old_entry);
+    }
+
+    return pointer;
+}
+
+void *trace_aligned_alloc(size_t alignment, size_t size, const char *file, int line){
+    void *pointer = aligned_alloc(alignment, size);
+    if(pointer){
+        record_allocation(pointer, size, file, line);
+    }
+
+    return pointer;
+}
+
+char *trace_strdup(const char *text, const char *file, int line){
+    char *copy = strdup(text);
+    if(copy){
+        record_allocation(copy, strlen(copy) + 1, file, line);
+    }
+
+    return copy;
+}
+
+char *trace_strndup(const char *text, size_t length, const char *file, int line){
+    char *copy = strndup(text, length);
+    if(copy){
+        record_allocation(copy, strlen(copy) + 1, file, line);
+    }
+
+    return copy;
+}
+
+void trace_free(void *pointer){
+    if(pointer){
+        forget_allocation(pointer);
+        free(pointer);
+    }
+}
+
+/**
+ * @brief Orders sites by decreasing number of allocations.
+ */
+static int compare_sites(const void *a, const void *b){
+    const TraceSite *first = *(const TraceSite * const *)a;
+    const TraceSite *second = *(const TraceSite * const *)b;
+
+    if(first->calls != second->calls){
+        return first->calls < second->calls ? 1 : -1;
+    }
+
+    return first->line - second->line;
+}
+
+/**
+ * @brief Checks a measured value against its limit.
+ * @return SUCCESS if the budget is respected, otherwise FAILURE.
+ */
+static int check_budget(FILE *out, const char *name, unsigned long long limit, unsigned long long value){
+    if(value <= limit){
+        return SUCCESS;
+    }
+
+    fprintf(out, "Budget exceeded: %s=%llu, measured %llu\n", name, limit, value);
+    return FAILURE;
+}
+
+/**
+ * @brief Checks one budget from the environment.
+ * @return SUCCESS if the budget is unset or respected, otherwise FAILURE.
+ */
+static int within_budget(FILE *out, const char *variable, unsigned long long value){
+    const char *budget = getenv(variable);
+    if(!budget || !*budget){
+        return SUCCESS;
+    }
+
+    return check_budget(out, variable, strtoull(budget, NULL, 10), value);
+}
+
+/**
+ * @brief Checks the budgets of one row of a budget file (MP3TAG_ALLOC_BUDGET=file:row).
+ * @return SUCCESS if the variable is unset or the row is respected, FAILURE if it is exceeded or missing.
+ */
+static int within_budget_file(FILE *out, unsigned long long peak_rss){
+    const char *setting = getenv("MP3TAG_ALLOC_BUDGET");
+    if(!setting || !*setting){
+        return SUCCESS;
+    }
+
+    char path[FILENAME_MAX];
+    const char *row = strrchr(setting, ':');
+    if(!row || (size_t)(row - setting) >= sizeof(path)){
+        fprintf(out, "Budget missing: MP3TAG_ALLOC_BUDGET must be file:row, got \"%s\"\n", setting);
+        return FAILURE;
+    }
+    memcpy(path, setting, row - setting);
+    path[row - setting] = '\0';
+    row++;
+
+    FILE *file = fopen(path, "r");
+    if(!file){
+        fprintf(out, "Budget missing: can't read %s\n", path);
+        return FAILURE;
+    }
+
+    // A row a run asks for must exist with every limit, a missing budget never passes
+    char line[256];
+    int status = FAILURE, found = 0;
+    while(!found && fgets(line, sizeof(line), file)){
+        char name[64];
+        unsigned long long calls, peak, rss, leaked;
+        if(line[0] == '#' || sscanf(line, "%63s", name) != 1 || strcmp(name, row) != 0){
+            continue;
+        }
+
+        found = 1;
+        if(sscanf(line, "%63s %llu %llu %llu %llu", name, &calls, &peak, &rss, &leaked) == 5){
+            status = check_budget(out, "calls", calls, total_calls);
+            status = check_budget(out, "peak_heap", peak, peak_bytes) && status;
+            status = check_budget(out, "peak_rss_kib", rss, peak_rss) && status;
+            status = check_budget(out, "leaked", leaked, live_bytes) && status;
+        }
+        else{
+            fprintf(out, "Budget missing: row %s of %s needs calls, peak_heap, peak_rss_kib and leaked\n", row, path);
+        }
+    }
+    fclose(file);
+
+    if(!found){
+        fprintf(out, "Budget missing: no row %s in %s\n", row, path);
+    }
+
+    return status;
+}
+
+/**
+ * @brief Prints the allocation report at exit and enforces the budgets.
+ */
+static void report_alloc_trace(void){
+    const char *path = getenv("MP3TAG_ALLOC_TRACE");
+    FILE *out = path && *path ? fopen(path, "w") : NULL;
+    if(!out){
+        out = stderr;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    pthread_mutex_lock(&trace_lock);
+
+    const TraceSite *sorted[TRACE_SITE_SLOTS + 1];
+    size_t count = 0;
+    for(size_t i = 0; i < TRACE_SITE_SLOTS; i++){
+        if(trace_sites[i].file){
+            sorted[count++] = &trace_sites[i];
+        }
+    }
+    if(overflow_site.calls){
+        sorted[count++] = &overflow_site;
+    }
+    qsort(sorted, count, sizeof(TraceSite *), compare_sites);
+
+    fprintf(out, "Allocation trace: %zu allocations, %llu bytes, peak live heap %llu bytes, peak RSS %ld KiB, %llu bytes live at exit\n",
+            total_calls, total_bytes, peak_bytes, usage.ru_maxrss, live_bytes);
+    fprintf(out, "%-32s %10s %14s %10s\n", "site", "calls", "bytes", "live");
+    for(size_t i = 0; i < count; i++){
+        char site[64];
+        snprintf(site, sizeof(site), "%s:%d", sorted[i]->file, sorted[i]->line);
+        fprintf(out, "%-32s %10zu %14llu %10lld\n", site, sorted[i]->calls, sorted[i]->bytes, sorted[i]->live);
+    }
+
+    int ok = within_budget(out, "MP3TAG_ALLOC_MAX_CALLS", total_calls);
+    ok = within_budget(out, "MP3TAG_ALLOC_MAX_PEAK", peak_bytes) && ok;
+    ok = within_budget(out, "MP3TAG_ALLOC_MAX_RSS", (unsigned long long)usage.ru_maxrss) && ok;
+    ok = within_budget(out, "MP3TAG_ALLOC_MAX_LEAKED", live_bytes) && ok;
+    ok = within_budget_file(out, (unsigned long long)usage.ru_maxrss) && ok;
+
+    pthread_mutex_unlock(&trace_lock);
+
+    fflush(out);
+    if(out != stderr){
+        fclose(out);
+    }
+
+    if(!ok){
+        _exit(3);
+    }
+}
+
+/**
+ * @brief Registers the exit report.
+ */
+void start_alloc_trace(void){
+    atexit(report_alloc_trace);
+}
+
+#endif // ALLOC_TRACE
@@ -0,0 +1,50 @@
+#ifndef ALLOC_TRACE_H
+#define ALLOC_TRACE_H
+
+#include <stddef.h>
+
+/*
+ * Allocation tracing build mode (make trace).
+ *
+ * With -DALLOC_TRACE every allocation made by the application goes through a counting
+ * hook that records calls and bytes per call site, the live and peak live heap, and the
+ * sites that still own memory at exit. Memory allocated inside libc (getline, nftw...)
+ * is not counted and is released untouched.
+ */
+
+/**
+ * @brief Registers the exit report and reads the budgets from the environment.
+ *
+ * MP3TAG_ALLOC_TRACE       File the report is written to (default: stderr)
+ * MP3TAG_ALLOC_MAX_CALLS   Maximum number of allocations
+ * MP3TAG_ALLOC_MAX_PEAK    Maximum peak live heap, in bytes
+ * MP3TAG_ALLOC_MAX_RSS     Maximum peak resident set size, in KiB
+ * MP3TAG_ALLOC_MAX_LEAKED  Maximum bytes still allocated at exit
+ * MP3TAG_ALLOC_BUDGET      file:row, the four limits above from a row of a budget file
+ *                          ("row calls peak_heap peak_rss_kib leaked", '#' starts a comment)
+ *
+ * When a budget is exceeded, or the budget file or row is missing, the process exits with status 3.
+ */
+void start_alloc_trace(void);
+
+void *trace_malloc(size_t, const char *, int);
+void *trace_calloc(size_t, size_t, const char *, int);
+void *trace_realloc(void *, size_t, const char *, int);
+void *trace_aligned_alloc(size_t, size_t, const char *, int);
+char *trace_strdup(const char *, const char *, int);
+char *trace_strndup(const char *, size_t, const char *, int);
+void trace_free(void *);
+
+#if defined(ALLOC_TRACE) && !defined(ALLOC_TRACE_IMPLEMENTATION)
+#undef strdup
+#undef strndup
+#define malloc(size) trace_malloc(size, __FILE__, __LINE__)
+#define calloc(count, size) trace_calloc(count, size, __FILE__, __LINE__)
+#define realloc(pointer, size) trace_realloc(pointer, size, __FILE__, __LINE__)
+#define aligned_alloc(alignment, size) trace_aligned_alloc(alignment, size, __FILE__, __LINE__)
+#define strdup(text) trace_strdup(text, __FILE__, __LINE__)
+#define strndup(text, length) trace_strndup(text, length, __FILE__, __LINE__)
+#define free(pointer) trace_free(pointer)
+#endif
+
+#endif // ALLOC_TRACE_H
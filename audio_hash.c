@@ -0,0 +1,434 @@
+/**
+ * @file audio_hash.c
+ * @brief Audio payload hashing (XXH64) and the identity keyed hash cache.
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "audio_hash.h"
+#include "id3_utils.h"
+#include "throttle.h"
+#include "error_handling.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define ID3V1_TAG_SIZE 128
+#define APE_FOOTER_SIZE 32
+
+/**
+ * @brief One cached file identity and its payload hash.
+ */
+typedef struct {
+    unsigned long long device;   /**< Device number, 0 marks an empty slot together with inode 0 */
+    unsigned long long inode;    /**< Inode number */
+    long long size;              /**< File size */
+    long long mtime_sec;         /**< Modification time, seconds */
+    long mtime_nsec;             /**< Modification time, nanoseconds */
+    uint64_t hash;               /**< Audio payload hash */
+} HashCacheEntry;
+
+/**
+ * @brief Open addressing table of cached hashes, keyed by device and inode.
+ */
+typedef struct {
+    char *path;                  /**< File the cache is loaded from and saved to */
+    HashCacheEntry *entries;     /**< Slots */
+    size_t capacity;             /**< Number of slots (power of two) */
+    size_t count;                /**< Number of used slots */
+    int dirty;                   /**< Whether the cache changed since it was loaded */
+    pthread_mutex_t lock;        /**< Guards the table, workers look up and store concurrently */
+} HashCache;
+
+static HashCache hash_cache = {NULL, NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t rotate_left(uint64_t value, int bits){
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read_le64(const unsigned char *bytes){
+    uint64_t value = 0;
+    for(int i = 7; i >= 0; i--){
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+static uint32_t read_le32(const unsigned char *bytes){
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static uint64_t hash_round(uint64_t accumulator, uint64_t input){
+    accumulator += input * PRIME64_2;
+    accumulator = rotate_left(accumulator, 31);
+    return accumulator * PRIME64_1;
+}
+
+static uint64_t merge_round(uint64_t accumulator, uint64_t value){
+    accumulator ^= hash_round(0, value);
+    return accumulator * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * @brief Starts hashing a payload of the given length.
+ */
+void init_audio_hash(AudioHash *hash, unsigned long long payload_length){
+    memset(hash, 0, sizeof(AudioHash));
+    hash->accumulators[0] = PRIME64_1 + PRIME64_2;
+    hash->accumulators[1] = PRIME64_2;
+    hash->accumulators[2] = 0;
+    hash->accumulators[3] = -PRIME64_1;
+    hash->remaining = payload_length;
+}
+
+/**
+ * @brief Consumes one 32 byte stripe.
+ */
+static void hash_stripe(AudioHash *hash, const unsigned char *stripe){
+    for(int lane = 0; lane < 4; lane++){
+        hash->accumulators[lane] = hash_round(hash->accumulators[lane], read_le64(stripe + lane * 8));
+    }
+}
+
+/**
+ * @brief Feeds bytes to the hash, ignoring whatever goes past the payload length.
+ */
+void update_audio_hash(AudioHash *hash, const void *bytes, size_t length){
+    const unsigned char *input = (const unsigned char *)bytes;
+
+    if(length > hash->remaining){
+        length = hash->remaining;
+    }
+    hash->remaining -= length;
+    hash->total_length += length;
+
+    // Complete the pending stripe first
+    if(hash->pending_length){
+        size_t fill = 32 - hash->pending_length < length ? 32 - hash->pending_length : length;
+        memcpy(hash->pending + hash->pending_length, input, fill);
+        hash->pending_length += fill;
+        input += fill;
+        length -= fill;
+
+        if(hash->pending_length < 32){
+            return;
+        }
+        hash_stripe(hash, hash->pending);
+        hash->pending_length = 0;
+    }
+
+    for(; length >= 32; input += 32, length -= 32){
+        hash_stripe(hash, input);
+    }
+
+    memcpy(hash->pending, input, length);
+    hash->pending_length = length;
+}
+
+/**
+ * @brief Returns the hash of the bytes fed so far.
+ */
+uint64_t finish_audio_hash(const AudioHash *hash){
+    uint64_t result;
+
+    if(hash->total_length >= 32){
+        const uint64_t *acc = hash->accumulators;
+        result = rotate_left(acc[0], 1) + rotate_left(acc[1], 7) + rotate_left(acc[2], 12) + rotate_left(acc[3], 18);
+        for(int lane = 0; lane < 4; lane++){
+            result = merge_round(result, acc[lane]);
+        }
+    }
+    else{
+        result = PRIME64_5;
+    }
+    result += hash->total_length;
+
+    const unsigned char *tail = hash->pending;
+    unsigned int length = hash->pending_length;
+
+    for(; length >= 8; tail += 8, length -= 8){
+        result ^= hash_round(0, read_le64(tail));
+        result = rotate_left(result, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if(length >= 4){
+        result ^= (uint64_t)read_le32(tail) * PRIME64_1;
+        result = rotate_left(result, 23) * PRIME64_2 + PRIME64_3;
+        tail += 4;
+        length -= 4;
+    }
+    for(; length > 0; tail++, length--){
+        result ^= (*tail) * PRIME64_5;
+        result = rotate_left(result, 11) * PRIME64_1;
+    }
+
+    result ^= result >> 33;
+    result *= PRIME64_2;
+    result ^= result >> 29;
+    result *= PRIME64_3;
+    result ^= result >> 32;
+
+    return result;
+}
+
+/**
+ * @brief Locates the audio payload of an open file.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int audio_payload_range(int fd, unsigned long long *start, unsigned long long *end){
+    struct stat info;
+    if(fstat(fd, &info) != 0){
+        return FAILURE;
+    }
+
+    *start = 0;
+    *end = info.st_size;
+
+    unsigned char tag_header[TAG_HEADER_SIZE];
+    if(pread(fd, tag_header, TAG_HEADER_SIZE, 0) == TAG_HEADER_SIZE && memcmp(tag_header, "ID3", 3) == 0){
+        *start = TAG_HEADER_SIZE + decode_syncsafe(&tag_header[6]);
+        // ID3v2.4 tags may carry a 10 byte footer after the padding
+        if(tag_header[3] == 4 && (tag_header[5] & TAG_FLAG_FOOTER)){
+            *start += TAG_HEADER_SIZE;
+        }
+    }
+    if(*start > *end){
+        *start = *end;
+    }
+
+    // ID3v1 tag: the last 128 bytes start with "TAG"
+    unsigned char trailer[APE_FOOTER_SIZE];
+    if(*end - *start >= ID3V1_TAG_SIZE && pread(fd, trailer, 3, *end - ID3V1_TAG_SIZE) == 3 && memcmp(trailer, "TAG", 3) == 0){
+        *end -= ID3V1_TAG_SIZE;
+    }
+
+    // APEv2 tag: a 32 byte footer starting with "APETAGEX", its size covers the items and the footer
+    if(*end - *start >= APE_FOOTER_SIZE && pread(fd, trailer, APE_FOOTER_SIZE, *end - APE_FOOTER_SIZE) == APE_FOOTER_SIZE
+       && memcmp(trailer, "APETAGEX", 8) == 0){
+        unsigned long long ape_size = read_le32(trailer + 12);
+        // Bit 31 of the flags tells that a 32 byte header precedes the items
+        if(read_le32(trailer + 20) & 0x80000000U){
+            ape_size += APE_FOOTER_SIZE;
+        }
+        if(ape_size <= *end - *start){
+            *end -= ape_size;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Hashes the audio payload of a file, using the hash cache when the file is known and unchanged.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int hash_audio_file(const char *path, uint64_t *hash){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return FAILURE;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) == 0 && lookup_audio_hash(&info, hash)){
+        close(fd);
+        return SUCCESS;
+    }
+
+    unsigned long long start, end;
+    if(!audio_payload_range(fd, &start, &end)){
+        close(fd);
+        return FAILURE;
+    }
+
+    posix_fadvise(fd, start, end - start, POSIX_FADV_SEQUENTIAL);
+
+    AudioHash state;
+    init_audio_hash(&state, end - start);
+
+    unsigned char buffer[64 * 1024];
+    unsigned long long offset = start;
+    while(offset < end){
+        ssize_t bytes = pread(fd, buffer, sizeof(buffer), offset);
+        if(bytes <= 0){
+            close(fd);
+            return FAILURE;
+        }
+        throttle_read(bytes);
+        update_audio_hash(&state, buffer, bytes);
+        offset += bytes;
+    }
+    close(fd);
+
+    *hash = finish_audio_hash(&state);
+    store_audio_hash(&info, *hash);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Returns the slot of an inode, either holding it or empty.
+ */
+static HashCacheEntry *find_slot(unsigned long long device, unsigned long long inode){
+    size_t mask = hash_cache.capacity - 1;
+    size_t slot = (size_t)((inode * PRIME64_1) ^ (device * PRIME64_2)) & mask;
+
+    while(hash_cache.entries[slot].inode || hash_cache.entries[slot].device){
+        if(hash_cache.entries[slot].inode == inode && hash_cache.entries[slot].device == device){
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return &hash_cache.entries[slot];
+}
+
+/**
+ * @brief Inserts or replaces an entry, growing the table when it gets half full.
+ */
+static void insert_entry(const HashCacheEntry *entry){
+    if((hash_cache.count + 1) * 2 > hash_cache.capacity){
+        HashCacheEntry *old_entries = hash_cache.entries;
+        size_t old_capacity = hash_cache.capacity;
+        size_t new_capacity = old_capacity ? old_capacity * 2 : 1024;
+
+        HashCacheEntry *grown = (HashCacheEntry *)calloc(new_capacity, sizeof(HashCacheEntry));
+        if(!grown){
+            perror("Memory allocation failed");
+            return;
+        }
+        hash_cache.entries = grown;
+        hash_cache.capacity = new_capacity;
+        hash_cache.count = 0;
+
+        for(size_t i = 0; i < old_capacity; i++){
+            if(old_entries[i].inode || old_entries[i].device){
+                *find_slot(old_entries[i].device, old_entries[i].inode) = old_entries[i];
+                hash_cache.count++;
+            }
+        }
+        free(old_entries);
+    }
+
+    HashCacheEntry *slot = find_slot(entry->device, entry->inode);
+    if(!slot->inode && !slot->device){
+        hash_cache.count++;
+    }
+    *slot = *entry;
+}
+
+/**
+ * @brief Loads the hash cache from a file and enables it (a NULL path leaves it disabled).
+ */
+void open_hash_cache(const char *path){
+    if(!path || !(hash_cache.path = strdup(path))){
+        return;
+    }
+
+    FILE *file = fopen(path, "r");
+    if(!file){
+        // No cache yet, it is created on close
+        return;
+    }
+
+    HashCacheEntry entry;
+    unsigned long long hash;
+    while(fscanf(file, "%llu %llu %lld %lld %ld %llx", &entry.device, &entry.inode, &entry.size, &entry.mtime_sec, &entry.mtime_nsec, &hash) == 6){
+        entry.hash = hash;
+        insert_entry(&entry);
+    }
+
+    fclose(file);
+}
+
+/**
+ * @brief Writes the hash cache back to its file and frees it.
+ */
+void close_hash_cache(){
+    if(!hash_cache.path){
+        return;
+    }
+
+    if(hash_cache.dirty){
+        char tmp_path[FILENAME_MAX];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", hash_cache.path);
+
+        FILE *file = fopen(tmp_path, "w");
+        if(file){
+            for(size_t i = 0; i < hash_cache.capacity; i++){
+                const HashCacheEntry *entry = &hash_cache.entries[i];
+                if(entry->inode || entry->device){
+                    fprintf(file, "%llu %llu %lld %lld %ld %016llx\n", entry->device, entry->inode, entry->size, entry->mtime_sec, entry->mtime_nsec, (unsigned long long)entry->hash);
+                }
+            }
+            if(fclose(file) == 0){
+                rename(tmp_path, hash_cache.path);
+            }
+        }
+        else{
+            perror("Failed to save hash cache");
+        }
+    }
+
+    free(hash_cache.entries);
+    free(hash_cache.path);
+    hash_cache.entries = NULL;
+    hash_cache.path = NULL;
+    hash_cache.capacity = hash_cache.count = 0;
+}
+
+/**
+ * @brief Tells whether a hash cache is in use.
+ */
+int hash_cache_enabled(){
+    return hash_cache.path != NULL;
+}
+
+/**
+ * @brief Looks up the payload hash of a file identity.
+ * @return SUCCESS if the identity is cached and unchanged otherwise FAILURE.
+ */
+int lookup_audio_hash(const struct stat *info, uint64_t *hash){
+    if(!hash_cache_enabled()){
+        return FAILURE;
+    }
+
+    pthread_mutex_lock(&hash_cache.lock);
+    if(hash_cache.capacity == 0){
+        pthread_mutex_unlock(&hash_cache.lock);
+        return FAILURE;
+    }
+    const HashCacheEntry *entry = find_slot(info->st_dev, info->st_ino);
+    int found = entry->inode == (unsigned long long)info->st_ino && entry->device == (unsigned long long)info->st_dev
+        && entry->size == info->st_size && entry->mtime_sec == info->st_mtim.tv_sec && entry->mtime_nsec == info->st_mtim.tv_nsec;
+    if(found){
+        *hash = entry->hash;
+    }
+    pthread_mutex_unlock(&hash_cache.lock);
+
+    return found ? SUCCESS : FAILURE;
+}
+
+/**
+ * @brief Records the payload hash of a file identity, replacing any older entry of the same inode.
+ */
+void store_audio_hash(const struct stat *info, uint64_t hash){
+    if(!hash_cache_enabled()){
+        return;
+    }
+
+    HashCacheEntry entry = {info->st_dev, info->st_ino, info->st_size, info->st_mtim.tv_sec, info->st_mtim.tv_nsec, hash};
+
+    pthread_mutex_lock(&hash_cache.lock);
+    insert_entry(&entry);
+    hash_cache.dirty = 1;
+    pthread_mutex_unlock(&hash_cache.lock);
+}
+
+/**
+ * @brief Formats a hash as 16 hexadecimal digits.
+ */
+void format_audio_hash(uint64_t hash, char *text){
+    sprintf(text, "%016llx", (unsigned long long)hash);
+}
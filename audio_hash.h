@@ -0,0 +1,91 @@
+#ifndef AUDIO_HASH_H
+#define AUDIO_HASH_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include "main.h"
+
+/**
+ * @brief Streaming XXH64 hash of the audio payload of a file.
+ *
+ * The audio payload starts after the ID3v2 tag and stops before any trailing
+ * APEv2 or ID3v1 tag, so retagging a file never changes its hash.
+ */
+typedef struct {
+    uint64_t accumulators[4];       /**< Lane accumulators */
+    uint64_t total_length;          /**< Bytes hashed so far */
+    unsigned char pending[32];      /**< Bytes waiting for a full 32 byte stripe */
+    unsigned int pending_length;    /**< Number of pending bytes */
+    unsigned long long remaining;   /**< Payload bytes still expected, anything past them is ignored */
+} AudioHash;
+
+/**
+ * @brief Starts hashing a payload of the given length.
+ */
+void init_audio_hash(AudioHash *, unsigned long long);
+
+/**
+ * @brief Feeds bytes to the hash, ignoring whatever goes past the payload length.
+ */
+void update_audio_hash(AudioHash *, const void *, size_t);
+
+/**
+ * @brief Returns the hash of the bytes fed so far.
+ */
+uint64_t finish_audio_hash(const AudioHash *);
+
+/**
+ * @brief Locates the audio payload of an open file.
+ *
+ * @param fd File descriptor of the MP3 file.
+ * @param start Set to the offset of the first audio byte (after the ID3v2 tag).
+ * @param end Set to the offset just past the last audio byte (before APEv2/ID3v1 tags).
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int audio_payload_range(int, unsigned long long *, unsigned long long *);
+
+/**
+ * @brief Hashes the audio payload of a file, using the hash cache when the file is known and unchanged.
+ *
+ * @param path Path of the MP3 file.
+ * @param hash Set to the payload hash.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int hash_audio_file(const char *, uint64_t *);
+
+/**
+ * @brief Loads the hash cache from a file and enables it (a NULL path leaves it disabled).
+ *
+ * The cache maps a file identity (device, inode, size, modification time) to its
+ * payload hash. Edits update it as they stream the audio, so the next scan doesn't
+ * need to read the file again. It is written back by close_hash_cache.
+ */
+void open_hash_cache(const char *);
+
+/**
+ * @brief Writes the hash cache back to its file and frees it.
+ */
+void close_hash_cache();
+
+/**
+ * @brief Tells whether a hash cache is in use.
+ */
+int hash_cache_enabled();
+
+/**
+ * @brief Looks up the payload hash of a file identity.
+ * @return SUCCESS if the identity is cached and unchanged otherwise FAILURE.
+ */
+int lookup_audio_hash(const struct stat *, uint64_t *);
+
+/**
+ * @brief Records the payload hash of a file identity, replacing any older entry of the same inode.
+ */
+void store_audio_hash(const struct stat *, uint64_t);
+
+/**
+ * @brief Formats a hash as 16 hexadecimal digits.
+ */
+void format_audio_hash(uint64_t, char *);
+
+#endif // AUDIO_HASH_H
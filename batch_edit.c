@@ -0,0 +1,436 @@
+/**
+ * @file batch_edit.c
+ * @brief Manifest driven bulk editing of ID3 tags.
+ */
+#include "batch_edit.h"
+#include "id3_writer.h"
+#include "worker_pool.h"
+#include "throttle.h"
+#include "checkpoint.h"
+#include "error_handling.h"
+
+/**
+ * @brief Appends an entry to the growing manifest array.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int add_entry(ManifestEntry **entries, size_t *count, size_t *capacity, const char *path, const char *field_name, const char *value, size_t line){
+    const TagField *field = find_tag_field_by_name(field_name);
+    if(!field){
+        fprintf(stderr, "Manifest line %zu: unknown field \"%s\"\n", line, field_name);
+        return FAILURE;
+    }
+
+    if(*count == *capacity){
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        ManifestEntry *grown = (ManifestEntry *)realloc(*entries, new_capacity * sizeof(ManifestEntry));
+        if(!grown){
+            perror("Memory allocation failed");
+            return FAILURE;
+        }
+        *entries = grown;
+        *capacity = new_capacity;
+    }
+
+    ManifestEntry *entry = &(*entries)[*count];
+    entry->path = strdup(path);
+    entry->value = strdup(value);
+    entry->option = field->option;
+    entry->line = line;
+    if(!entry->path || !entry->value){
+        perror("Memory allocation failed");
+        free(entry->path);
+        free(entry->value);
+        return FAILURE;
+    }
+    (*count)++;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Splits a CSV line in place into at most max_fields fields.
+ *
+ * Fields may be enclosed in double quotes, in which case commas are kept and
+ * a doubled quote stands for a literal quote.
+ *
+ * @return Number of fields found.
+ */
+static int split_csv_line(char *line, char **fields, int max_fields){
+    int field_count = 0;
+    char *read = line;
+
+    while(field_count < max_fields){
+        char *write = read;
+        fields[field_count++] = write;
+
+        if(*read == '"'){
+            read++;
+            while(*read){
+                if(*read == '"' && read[1] == '"'){
+                    *write++ = '"';
+                    read += 2;
+                }
+                else if(*read == '"'){
+                    read++;
+                    break;
+                }
+                else{
+                    *write++ = *read++;
+                }
+            }
+        }
+
+        while(*read && *read != ','){
+            *write++ = *read++;
+        }
+
+        if(*read == ','){
+            *write = '\0';
+            read++;
+        }
+        else{
+            *write = '\0';
+            break;
+        }
+    }
+
+    return field_count;
+}
+
+/**
+ * @brief Parses a JSON string starting at the opening quote, unescaping it in place.
+ * @return Pointer past the closing quote, NULL if the string is malformed.
+ */
+static char *parse_json_string(char *cursor, char **out){
+    if(*cursor != '"'){
+        return NULL;
+    }
+    cursor++;
+
+    char *write = cursor;
+    *out = cursor;
+
+    while(*cursor && *cursor != '"'){
+        if(*cursor != '\\'){
+            *write++ = *cursor++;
+            continue;
+        }
+
+        cursor++;
+        switch(*cursor){
+            case 'n': *write++ = '\n'; break;
+            case 't': *write++ = '\t'; break;
+            case 'r': *write++ = '\r'; break;
+            case 'b': *write++ = '\b'; break;
+            case 'f': *write++ = '\f'; break;
+            case 'u': {
+                // Tag text is written as ISO-8859-1, so only code points up to U+00FF are kept as is
+                unsigned int code = 0;
+                if(sscanf(cursor + 1, "%4x", &code) != 1){
+                    return NULL;
+                }
+                *write++ = code <= 0xFF ? (char)code : '?';
+                cursor += 4;
+                break;
+            }
+            case '\0': return NULL;
+            default: *write++ = *cursor; break;
+        }
+        cursor++;
+    }
+
+    if(*cursor != '"'){
+        return NULL;
+    }
+    *write = '\0';
+
+    return cursor + 1;
+}
+
+/**
+ * @brief Parses one JSONL object of string members into manifest entries.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int parse_json_line(char *line, size_t line_number, ManifestEntry **entries, size_t *count, size_t *capacity){
+    char *keys[TAG_FIELD_COUNT * 4];
+    char *values[TAG_FIELD_COUNT * 4];
+    int member_count = 0;
+    char *path = NULL;
+
+    char *cursor = line + strspn(line, " \t");
+    if(*cursor++ != '{'){
+        fprintf(stderr, "Manifest line %zu: expected a JSON object\n", line_number);
+        return FAILURE;
+    }
+
+    while(1){
+        cursor += strspn(cursor, " \t\r\n");
+        if(*cursor == '}'){
+            break;
+        }
+
+        char *key, *value;
+        if(!(cursor = parse_json_string(cursor, &key))){
+            break;
+        }
+        cursor += strspn(cursor, " \t");
+        if(*cursor++ != ':'){
+            cursor = NULL;
+            break;
+        }
+        cursor += strspn(cursor, " \t");
+        if(!(cursor = parse_json_string(cursor, &value))){
+            break;
+        }
+
+        if(strcmp(key, "path") == 0){
+            path = value;
+        }
+        else if(member_count < TAG_FIELD_COUNT * 4){
+            keys[member_count] = key;
+            values[member_count++] = value;
+        }
+
+        cursor += strspn(cursor, " \t");
+        if(*cursor == ','){
+            cursor++;
+        }
+    }
+
+    if(!cursor || !path){
+        fprintf(stderr, "Manifest line %zu: malformed JSON object or missing \"path\"\n", line_number);
+        return FAILURE;
+    }
+
+    for(int i = 0; i < member_count; i++){
+        if(!add_entry(entries, count, capacity, path, keys[i], values[i], line_number)){
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Reads a manifest of edits.
+ * @return Array of entries, NULL on failure.
+ */
+ManifestEntry *read_manifest(const char *filename, size_t *count){
+    FILE *manifest = fopen(filename, "r");
+    if(!manifest){
+        perror("Failed to open manifest");
+        return NULL;
+    }
+
+    ManifestEntry *entries = NULL;
+    size_t capacity = 0;
+    *count = 0;
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    size_t line_number = 0;
+    int status = SUCCESS;
+
+    while(status && (length = getline(&line, &line_capacity, manifest)) != -1){
+        line_number++;
+
+        // Strip the line ending (LF or CRLF)
+        while(length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')){
+            line[--length] = '\0';
+        }
+
+        char *start = line + strspn(line, " \t");
+        if(*start == '\0' || *start == '#'){
+            continue;
+        }
+
+        if(*start == '{'){
+            status = parse_json_line(start, line_number, &entries, count, &capacity);
+            continue;
+        }
+
+        char *fields[3];
+        if(split_csv_line(line, fields, 3) != 3){
+            fprintf(stderr, "Manifest line %zu: expected path,field,value\n", line_number);
+            status = FAILURE;
+            continue;
+        }
+
+        // Optional header line
+        if(line_number == 1 && strcmp(fields[0], "path") == 0 && strcmp(fields[1], "field") == 0){
+            continue;
+        }
+
+        status = add_entry(&entries, count, &capacity, fields[0], fields[1], fields[2], line_number);
+    }
+
+    free(line);
+    fclose(manifest);
+
+    if(!status){
+        free_manifest(entries, *count);
+        return NULL;
+    }
+
+    // An empty manifest is not an error, but callers expect a valid array
+    if(!entries && !(entries = (ManifestEntry *)calloc(1, sizeof(ManifestEntry)))){
+        perror("Memory allocation failed");
+    }
+
+    return entries;
+}
+
+/**
+ * @brief Frees the manifest entries.
+ */
+void free_manifest(ManifestEntry *entries, size_t count){
+    for(size_t i = 0; i < count; i++){
+        free(entries[i].path);
+        free(entries[i].value);
+    }
+    free(entries);
+}
+
+/**
+ * @brief Orders entries by path, then by manifest line.
+ */
+static int compare_entries(const void *a, const void *b){
+    const ManifestEntry *first = (const ManifestEntry *)a;
+    const ManifestEntry *second = (const ManifestEntry *)b;
+
+    int order = strcmp(first->path, second->path);
+    if(order){
+        return order;
+    }
+
+    return (first->line > second->line) - (first->line < second->line);
+}
+
+/**
+ * @brief Groups the manifest entries per file.
+ * @return Array of files, NULL on failure.
+ */
+BatchFile *group_manifest(ManifestEntry *entries, size_t entry_count, size_t *file_count){
+    qsort(entries, entry_count, sizeof(ManifestEntry), compare_entries);
+
+    BatchFile *files = (BatchFile *)calloc(entry_count ? entry_count : 1, sizeof(BatchFile));
+    if(!files){
+        perror("Memory allocation failed");
+        return NULL;
+    }
+
+    *file_count = 0;
+    for(size_t i = 0; i < entry_count; i++){
+        if(*file_count == 0 || strcmp(files[*file_count - 1].path, entries[i].path) != 0){
+            BatchFile *file = &files[(*file_count)++];
+            file->path = entries[i].path;
+            file->edits = create_tag_data();
+            file->option[0] = '-';
+            if(!file->edits){
+                perror("Memory allocation failed");
+                free_batch_files(files, *file_count);
+                return NULL;
+            }
+        }
+
+        BatchFile *file = &files[*file_count - 1];
+        // Later lines overwrite earlier edits of the same field
+        if(!set_tag_field(file->edits, entries[i].option, entries[i].value)){
+            free_batch_files(files, *file_count);
+            return NULL;
+        }
+        if(!strchr(file->option + 1, entries[i].option)){
+            file->option[strlen(file->option)] = entries[i].option;
+        }
+    }
+
+    return files;
+}
+
+/**
+ * @brief Frees the grouped files.
+ */
+void free_batch_files(BatchFile *files, size_t count){
+    for(size_t i = 0; i < count; i++){
+        free_tag_data(files[i].edits);
+    }
+    free(files);
+}
+
+/**
+ * @brief Worker task: applies all the edits of one file.
+ */
+static void batch_edit_task(size_t index, unsigned int worker, void *context){
+    BatchFile *file = &((BatchFile *)context)[index];
+    (void)worker;
+
+    if(file->resumed){
+        return;
+    }
+
+    throttle_file();
+    file->status = apply_tag_edits(file->path, file->edits, file->option);
+
+    // Failed files are tried again by a resumed run
+    if(file->status != EDIT_FAILED){
+        record_completed(file->path, file->status, NULL, 0);
+    }
+}
+
+/**
+ * @brief Applies every edit of the manifest, one pass per file, on a pool of worker threads.
+ * @return 0 if every file was edited or already up to date, non-zero otherwise.
+ */
+int run_batch_edit(const char *manifest, unsigned int thread_count){
+    size_t entry_count = 0;
+    ManifestEntry *entries = read_manifest(manifest, &entry_count);
+    if(!entries){
+        return 1;
+    }
+
+    size_t file_count = 0;
+    BatchFile *files = group_manifest(entries, entry_count, &file_count);
+    if(!files){
+        free_manifest(entries, entry_count);
+        return 1;
+    }
+
+    // Files completed by an interrupted run keep their outcome
+    for(size_t i = 0; i < file_count; i++){
+        files[i].resumed = find_completed(files[i].path, &files[i].status, NULL, NULL);
+    }
+
+    if(run_worker_pool(file_count, thread_count, batch_edit_task, files) != 0){
+        free_batch_files(files, file_count);
+        free_manifest(entries, entry_count);
+        return 1;
+    }
+
+    // Report per file outcomes once all workers are done, in manifest path order
+    size_t applied = 0, unchanged = 0, failed = 0;
+    for(size_t i = 0; i < file_count; i++){
+        switch(files[i].status){
+            case EDIT_APPLIED:
+            case EDIT_IN_PLACE:
+                printf("updated\t%s\t%s\n", files[i].option, files[i].path);
+                applied++;
+                break;
+            case EDIT_UNCHANGED:
+                printf("unchanged\t%s\t%s\n", files[i].option, files[i].path);
+                unchanged++;
+                break;
+            default:
+                printf("failed\t%s\t%s\n", files[i].option, files[i].path);
+                failed++;
+                break;
+        }
+    }
+
+    printf("Batch edit: %zu files, %zu updated, %zu unchanged, %zu failed\n", file_count, applied, unchanged, failed);
+
+    free_batch_files(files, file_count);
+    free_manifest(entries, entry_count);
+
+    return failed ? 1 : 0;
+}
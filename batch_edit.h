@@ -0,0 +1,71 @@
+#ifndef BATCH_EDIT_H
+#define BATCH_EDIT_H
+
+#include "main.h"
+#include "id3_utils.h"
+
+/**
+ * @brief One field edit read from the manifest.
+ */
+typedef struct {
+    char *path;         /**< MP3 file to edit */
+    char option;        /**< Option letter of the edited field */
+    char *value;        /**< New value of the field */
+    size_t line;        /**< Manifest line, later lines win for the same field */
+} ManifestEntry;
+
+/**
+ * @brief All the edits of one file, applied in a single pass.
+ */
+typedef struct {
+    const char *path;                   /**< MP3 file to edit */
+    TagData *edits;                     /**< New values of the edited fields */
+    char option[TAG_FIELD_COUNT + 2];   /**< Combined edit option, e.g. "-taA" */
+    int status;                         /**< EDIT_APPLIED, EDIT_UNCHANGED or EDIT_FAILED */
+    int resumed;                        /**< Completed by an interrupted run (see --resume) */
+} BatchFile;
+
+/**
+ * @brief Reads a manifest of edits.
+ *
+ * Two formats are accepted, chosen by the first non blank character of the file:
+ *   CSV   : path,field,value (one edit per line, fields may be "quoted")
+ *   JSONL : {"path": "a.mp3", "title": "...", "artist": "..."} (one file per line)
+ * Fields are named as in the report (title, artist, ...), by edit option (-t) or by frame ID (TIT2).
+ *
+ * @param filename Manifest file name.
+ * @param count Set to the number of entries read.
+ * @return Array of entries, NULL on failure.
+ */
+ManifestEntry *read_manifest(const char *, size_t *);
+
+/**
+ * @brief Frees the manifest entries.
+ */
+void free_manifest(ManifestEntry *, size_t);
+
+/**
+ * @brief Groups the manifest entries per file.
+ *
+ * @param entries Manifest entries (sorted in place by path).
+ * @param entry_count Number of entries.
+ * @param file_count Set to the number of distinct files.
+ * @return Array of files, NULL on failure.
+ */
+BatchFile *group_manifest(ManifestEntry *, size_t, size_t *);
+
+/**
+ * @brief Frees the grouped files.
+ */
+void free_batch_files(BatchFile *, size_t);
+
+/**
+ * @brief Applies every edit of the manifest, one pass per file, on a pool of worker threads.
+ *
+ * @param manifest Manifest file name.
+ * @param thread_count Number of worker threads (0 selects one per CPU).
+ * @return 0 if every file was edited or already up to date, non-zero otherwise.
+ */
+int run_batch_edit(const char *, unsigned int);
+
+#endif // BATCH_EDIT_H
@@ -0,0 +1,726 @@
+/**
+ * @file batch_scan.c
+ * @brief Reads the tags of many files, optionally in on-disk order.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include "batch_scan.h"
+#include "id3_reader.h"
+#include "tag_table.h"
+#include "worker_pool.h"
+#include "throttle.h"
+#include "checkpoint.h"
+#include "error_handling.h"
+
+// nftw has no user data argument, so the list being filled is kept here while walking
+static ScanList *walk_list;
+
+/**
+ * @brief Shared state of a scan run.
+ */
+typedef struct {
+    ScanList *list;              /**< Files to scan, in scan order */
+    const ScanOptions *options;  /**< Scan options */
+    TagTable *tables;            /**< One table per worker, merged once the pool is done */
+    const char *resumed;         /**< Files already scanned by an interrupted run, skipped */
+    size_t failed;               /**< Number of files that couldn't be read (updated atomically) */
+} ScanJob;
+
+/**
+ * @brief Appends a file to the scan list.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int add_scan_file(ScanList *list, const char *path, unsigned long long location){
+    if(list->count == list->capacity){
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 256;
+        ScanFile *grown = (ScanFile *)realloc(list->files, new_capacity * sizeof(ScanFile));
+        if(!grown){
+            perror("Memory allocation failed");
+            return FAILURE;
+        }
+        list->files = grown;
+        list->capacity = new_capacity;
+    }
+
+    char *copy = strdup(path);
+    if(!copy){
+        perror("Memory allocation failed");
+        return FAILURE;
+    }
+
+    list->files[list->count].path = copy;
+    list->files[list->count++].location = location;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief nftw callback: keeps regular files with the .mp3 extension.
+ */
+static int walk_entry(const char *path, const struct stat *info, int type, struct FTW *walk){
+    (void)walk;
+
+    if(type == FTW_F && S_ISREG(info->st_mode) && check_extension(path)){
+        return add_scan_file(walk_list, path, info->st_ino) ? 0 : 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Collects the MP3 files named on the command line, walking directories recursively.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int collect_scan_files(char **paths, int path_count, ScanList *list){
+    walk_list = list;
+
+    for(int i = 0; i < path_count; i++){
+        struct stat info;
+        if(stat(paths[i], &info) != 0){
+            perror(paths[i]);
+            continue;
+        }
+
+        if(S_ISDIR(info.st_mode)){
+            if(nftw(paths[i], walk_entry, 64, FTW_PHYS) != 0){
+                return FAILURE;
+            }
+        }
+        // Files named explicitly are scanned whatever their extension
+        else if(!add_scan_file(list, paths[i], info.st_ino)){
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Returns the physical byte offset of the first extent of a file.
+ * @return SUCCESS if the filesystem reported an extent otherwise FAILURE.
+ */
+static int first_physical_extent(const char *path, unsigned long long *location){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return FAILURE;
+    }
+
+    struct {
+        struct fiemap map;
+        struct fiemap_extent extent;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.map.fm_start = 0;
+    request.map.fm_length = TAG_HEADER_SIZE;
+    request.map.fm_extent_count = 1;
+
+    int status = ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents == 1;
+    if(status){
+        *location = request.extent.fe_physical;
+    }
+    close(fd);
+
+    return status ? SUCCESS : FAILURE;
+}
+
+/**
+ * @brief Orders files by their sort key.
+ */
+static int compare_locations(const void *a, const void *b){
+    unsigned long long first = ((const ScanFile *)a)->location;
+    unsigned long long second = ((const ScanFile *)b)->location;
+
+    return (first > second) - (first < second);
+}
+
+/**
+ * @brief Sorts the files by inode number or by physical location (FIEMAP) of their first block.
+ */
+void order_scan_files(ScanList *list, int order){
+    if(order == SCAN_ORDER_DIRECTORY){
+        return;
+    }
+
+    if(order == SCAN_ORDER_PHYSICAL){
+        // Physical offsets and inode numbers can't be mixed, so the first failure switches the whole list to inodes
+        unsigned long long *locations = (unsigned long long *)calloc(list->count ? list->count : 1, sizeof(unsigned long long));
+        size_t mapped = 0;
+
+        while(locations && mapped < list->count && first_physical_extent(list->files[mapped].path, &locations[mapped])){
+            mapped++;
+        }
+
+        if(locations && mapped == list->count){
+            for(size_t i = 0; i < list->count; i++){
+                list->files[i].location = locations[i];
+            }
+        }
+        else{
+            display_error("Physical extents unavailable on this filesystem, ordering by inode instead.");
+        }
+        free(locations);
+    }
+
+    qsort(list->files, list->count, sizeof(ScanFile), compare_locations);
+}
+
+/**
+ * @brief Frees the files of a scan list.
+ */
+void free_scan_list(ScanList *list){
+    for(size_t i = 0; i < list->count; i++){
+        free(list->files[i].path);
+    }
+    free(list->files);
+    list->files = NULL;
+    list->count = list->capacity = 0;
+}
+
+/**
+ * @brief Announces the tag region of a file to the kernel so it is read ahead asynchronously.
+ */
+void prefetch_tag_region(const char *path){
+    int fd = open(path, O_RDONLY | O_NOATIME);
+    if(fd < 0 && (fd = open(path, O_RDONLY)) < 0){
+        return;
+    }
+
+    // The readahead keeps going after close, the data is waiting in the page cache when the file is parsed
+    posix_fadvise(fd, 0, SCAN_READAHEAD_SIZE, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+/**
+ * @brief Reads the tag of one file.
+ * @return SUCCESS if the file could be read (with or without tag) otherwise FAILURE.
+ */
+int scan_file(const char *path, ScanRecord *record, int audio_hash){
+    memset(record, 0, sizeof(ScanRecord));
+
+    if(audio_hash){
+        record->hashed = hash_audio_file(path, &record->audio_hash);
+    }
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return FAILURE;
+    }
+
+    unsigned char tag_header[TAG_HEADER_SIZE];
+    if(pread(fd, tag_header, TAG_HEADER_SIZE, 0) != TAG_HEADER_SIZE || memcmp(tag_header, "ID3", 3) != 0){
+        close(fd);
+        return SUCCESS;
+    }
+
+    memcpy(record->version, &tag_header[3], 2);
+    record->tag_size = decode_syncsafe(&tag_header[6]);
+
+    // The whole tag is read with one request, it is parsed from memory
+    unsigned char *body = (unsigned char *)malloc(record->tag_size ? record->tag_size : 1);
+    if(!body){
+        perror("Memory allocation failed");
+        close(fd);
+        return FAILURE;
+    }
+
+    // Large tags (album art) go past the prefetched region, ask for the rest in one go
+    if(TAG_HEADER_SIZE + record->tag_size > SCAN_READAHEAD_SIZE){
+        posix_fadvise(fd, SCAN_READAHEAD_SIZE, TAG_HEADER_SIZE + record->tag_size - SCAN_READAHEAD_SIZE, POSIX_FADV_WILLNEED);
+    }
+
+    ssize_t length = pread(fd, body, record->tag_size, TAG_HEADER_SIZE);
+    close(fd);
+    throttle_read(length > 0 ? (size_t)length + TAG_HEADER_SIZE : TAG_HEADER_SIZE);
+    if(length > 0){
+        normalize_tag_body(body, (unsigned int)length, tag_header[3], &tag_header[5]);
+    }
+
+    // A truncated tag is parsed as far as it goes
+    record->data = length >= 0 ? parse_tag_body(body, (unsigned int)length, tag_header[3], &record->layout) : NULL;
+    free(body);
+
+    return record->data ? SUCCESS : FAILURE;
+}
+
+// Size of the fixed part of an encoded scan record
+#define SCAN_RECORD_FIXED_SIZE (4 + 5 * 4 + 8)
+
+/**
+ * @brief Writes an unsigned integer big-endian over the given number of bytes.
+ */
+static void put_be(unsigned char *bytes, uint64_t value, int size){
+    for(int i = size - 1; i >= 0; i--, value >>= 8){
+        bytes[i] = value & 0xFF;
+    }
+}
+
+/**
+ * @brief Reads an unsigned big-endian integer of the given number of bytes.
+ */
+static uint64_t get_be(const unsigned char *bytes, int size){
+    uint64_t value = 0;
+    for(int i = 0; i < size; i++){
+        value = (value << 8) | bytes[i];
+    }
+
+    return value;
+}
+
+/**
+ * @brief Serializes a scan record into a compact byte string.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int encode_scan_record(TagBuffer *buffer, const ScanRecord *record){
+    unsigned char fixed[SCAN_RECORD_FIXED_SIZE];
+
+    fixed[0] = record->version[0];
+    fixed[1] = record->version[1];
+    fixed[2] = record->data != NULL;
+    fixed[3] = record->hashed != 0;
+    put_be(fixed + 4, record->tag_size, 4);
+    put_be(fixed + 8, record->layout.frames_length, 4);
+    put_be(fixed + 12, record->layout.frame_count, 4);
+    put_be(fixed + 16, record->layout.art_size, 4);
+    put_be(fixed + 20, record->layout.art_offset, 4);
+    put_be(fixed + 24, record->audio_hash, 8);
+
+    if(!append_tag_bytes(buffer, fixed, sizeof(fixed))){
+        return FAILURE;
+    }
+
+    for(int i = 0; record->data && i < TAG_FIELD_COUNT; i++){
+        const char *value = *tag_field_value(record->data, tag_fields[i].option);
+        unsigned char present = value != NULL;
+
+        if(!append_tag_bytes(buffer, &present, 1) || (value && !append_tag_bytes(buffer, value, strlen(value) + 1))){
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Rebuilds a scan record serialized by encode_scan_record.
+ * @return SUCCESS on success, FAILURE if the bytes are malformed.
+ */
+int decode_scan_record(const unsigned char *bytes, size_t length, ScanRecord *record){
+    memset(record, 0, sizeof(ScanRecord));
+    if(length < SCAN_RECORD_FIXED_SIZE){
+        return FAILURE;
+    }
+
+    record->version[0] = bytes[0];
+    record->version[1] = bytes[1];
+    record->hashed = bytes[3];
+    record->tag_size = (unsigned int)get_be(bytes + 4, 4);
+    record->layout.frames_length = (unsigned int)get_be(bytes + 8, 4);
+    record->layout.frame_count = (unsigned int)get_be(bytes + 12, 4);
+    record->layout.art_size = (unsigned int)get_be(bytes + 16, 4);
+    record->layout.art_offset = (unsigned int)get_be(bytes + 20, 4);
+    record->audio_hash = get_be(bytes + 24, 8);
+
+    if(!bytes[2]){
+        return length == SCAN_RECORD_FIXED_SIZE;
+    }
+
+    if(!(record->data = create_tag_data())){
+        perror("Memory allocation failed");
+        return FAILURE;
+    }
+
+    size_t position = SCAN_RECORD_FIXED_SIZE;
+    for(int i = 0; i < TAG_FIELD_COUNT; i++){
+        if(position >= length){
+            break;
+        }
+        if(!bytes[position++]){
+            continue;
+        }
+
+        const unsigned char *end = memchr(bytes + position, '\0', length - position);
+        if(!end){
+            break;
+        }
+
+        char **slot = tag_field_value(record->data, tag_fields[i].option);
+        if(!(*slot = strdup((const char *)bytes + position))){
+            perror("Memory allocation failed");
+            break;
+        }
+        position = end + 1 - bytes;
+    }
+
+    if(position != length){
+        free_tag_data(record->data);
+        record->data = NULL;
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Prints a field value, replacing tabs and line breaks so a record stays on one line.
+ */
+void print_scan_field(FILE *out, const char *value){
+    fputc('\t', out);
+    for(; value && *value; value++){
+        fputc(*value == '\t' || *value == '\n' || *value == '\r' ? ' ' : *value, out);
+    }
+}
+
+/**
+ * @brief Prints the header line naming the record columns.
+ */
+void print_scan_header(FILE *out, int audio_hash){
+    fprintf(out, "# path\tversion\ttag_size");
+    for(int i = 0; i < TAG_FIELD_COUNT; i++){
+        fprintf(out, "\t%s", tag_fields[i].name);
+    }
+    fprintf(out, audio_hash ? "\taudio_hash\n" : "\n");
+}
+
+/**
+ * @brief Prints one scan record as a tab separated line.
+ */
+void print_scan_record(FILE *out, const char *path, const ScanRecord *record){
+    fputs(path, out);
+
+    if(!record->data){
+        fprintf(out, "\t-\t0");
+    }
+    else{
+        fprintf(out, "\t2.%u.%u\t%u", record->version[0], record->version[1], record->tag_size);
+    }
+
+    for(int i = 0; i < TAG_FIELD_COUNT; i++){
+        print_scan_field(out, record->data ? *tag_field_value(record->data, tag_fields[i].option) : NULL);
+    }
+    if(record->hashed){
+        char hash_text[17];
+        format_audio_hash(record->audio_hash, hash_text);
+        fprintf(out, "\t%s", hash_text);
+    }
+    fputc('\n', out);
+}
+
+/**
+ * @brief Parses an ordering name (directory, inode, physical).
+ * @return SCAN_ORDER_* value, -1 if the name is unknown.
+ */
+int parse_scan_order(const char *name){
+    if(strcmp(name, "directory") == 0){
+        return SCAN_ORDER_DIRECTORY;
+    }
+    if(strcmp(name, "inode") == 0){
+        return SCAN_ORDER_INODE;
+    }
+    if(strcmp(name, "physical") == 0){
+        return SCAN_ORDER_PHYSICAL;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Parses a shard selection "i/N" (1 <= i <= N <= SCAN_SHARD_MAX).
+ * @return SUCCESS on success, FAILURE if the text isn't a valid selection.
+ */
+int parse_scan_shard(const char *text, unsigned int *index, unsigned int *count){
+    char *end;
+    unsigned long shard = strtoul(text, &end, 10);
+    if(end == text || *end != '/'){
+        return FAILURE;
+    }
+
+    const char *rest = end + 1;
+    unsigned long shards = strtoul(rest, &end, 10);
+    if(end == rest || *end != '\0' || shard < 1 || shard > shards || shards > SCAN_SHARD_MAX){
+        return FAILURE;
+    }
+
+    *index = (unsigned int)shard;
+    *count = (unsigned int)shards;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Returns the shard (0 based) a path belongs to.
+ */
+static unsigned int path_shard(const char *path, unsigned int count){
+    // FNV-1a, then a final mix so every bit of the path reaches the low bits the modulo keeps
+    uint64_t hash = 14695981039346656037ULL;
+    for(; *path; path++){
+        hash = (hash ^ (unsigned char)*path) * 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return (unsigned int)(hash % count);
+}
+
+/**
+ * @brief Keeps only the files of the selected shard, in their order.
+ */
+static void select_scan_shard(ScanList *list, unsigned int index, unsigned int count){
+    size_t kept = 0;
+
+    for(size_t i = 0; i < list->count; i++){
+        if(path_shard(list->files[i].path, count) == index - 1){
+            list->files[kept++] = list->files[i];
+        }
+        else{
+            free(list->files[i].path);
+        }
+    }
+
+    list->count = kept;
+}
+
+/**
+ * @brief Collects and orders the files to scan, and prefetches the first ones.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int prepare_scan_list(char **paths, int path_count, const ScanOptions *options, ScanList *list){
+    if(!collect_scan_files(paths, path_count, list)){
+        free_scan_list(list);
+        return FAILURE;
+    }
+    if(options->shard_count){
+        select_scan_shard(list, options->shard_index, options->shard_count);
+    }
+    order_scan_files(list, options->order);
+
+    // Prime the prefetch window, the workers keep it SCAN_PREFETCH_DISTANCE files ahead
+    for(size_t i = 0; i < list->count && i < SCAN_PREFETCH_DISTANCE; i++){
+        prefetch_tag_region(list->files[i].path);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Keeps the prefetch window ahead of the file about to be parsed.
+ */
+void prefetch_ahead(const ScanList *list, size_t index){
+    if(index + SCAN_PREFETCH_DISTANCE < list->count){
+        prefetch_tag_region(list->files[index + SCAN_PREFETCH_DISTANCE].path);
+    }
+}
+
+/**
+ * @brief Worker task: prefetches a file further down the list, then parses one file into the worker's table.
+ */
+static void scan_task(size_t index, unsigned int worker, void *context){
+    ScanJob *job = (ScanJob *)context;
+
+    if(job->resumed[index]){
+        return;
+    }
+
+    throttle_file();
+    prefetch_ahead(job->list, index);
+
+    const char *path = job->list->files[index].path;
+    ScanRecord record;
+    if(!scan_file(path, &record, job->options->audio_hash) || (job->options->audio_hash && !record.hashed)
+       || !add_tag_row(&job->tables[worker], index, &record)){
+        fprintf(stderr, "Failed to read %s\n", path);
+        __atomic_add_fetch(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+    else if(checkpoint_enabled()){
+        // The parsed record goes to the checkpoint, a resumed run doesn't read the file again
+        TagBuffer encoded;
+        init_tag_buffer(&encoded);
+        if(encode_scan_record(&encoded, &record)){
+            record_completed(path, SUCCESS, encoded.data, encoded.length);
+        }
+        free_tag_buffer(&encoded);
+    }
+
+    free_tag_data(record.data);
+}
+
+// Table used by compare_hash_rows, qsort has no context argument
+static const TagTable *sort_table;
+
+/**
+ * @brief Orders table rows by audio hash, then by scan order.
+ */
+static int compare_hash_rows(const void *a, const void *b){
+    size_t first = *(const size_t *)a;
+    size_t second = *(const size_t *)b;
+
+    if(sort_table->audio_hash[first] != sort_table->audio_hash[second]){
+        return sort_table->audio_hash[first] > sort_table->audio_hash[second] ? 1 : -1;
+    }
+
+    return (sort_table->file[first] > sort_table->file[second]) - (sort_table->file[first] < sort_table->file[second]);
+}
+
+/**
+ * @brief Prints every group of files sharing the same audio hash, one "hash<TAB>path" line per file.
+ */
+void print_duplicates(const ScanList *list, const TagTable *table){
+    size_t *rows = (size_t *)calloc(table->count ? table->count : 1, sizeof(size_t));
+    if(!rows){
+        perror("Memory allocation failed");
+        return;
+    }
+
+    size_t count = 0;
+    for(size_t row = 0; row < table->count; row++){
+        if(table->flags[row] & TAG_ROW_HASHED){
+            rows[count++] = row;
+        }
+    }
+
+    sort_table = table;
+    qsort(rows, count, sizeof(size_t), compare_hash_rows);
+
+    size_t groups = 0;
+    for(size_t start = 0, end; start < count; start = end){
+        for(end = start + 1; end < count && table->audio_hash[rows[end]] == table->audio_hash[rows[start]]; end++);
+
+        if(end - start < 2){
+            continue;
+        }
+
+        char hash_text[17];
+        format_audio_hash(table->audio_hash[rows[start]], hash_text);
+        for(size_t i = start; i < end; i++){
+            printf("%s\t%s\n", hash_text, list->files[table->file[rows[i]]].path);
+        }
+        groups++;
+    }
+
+    printf("Duplicates: %zu groups among %zu files\n", groups, count);
+    free(rows);
+}
+
+/**
+ * @brief Prints the rows of a table in scan order.
+ */
+void print_tag_table(const ScanList *list, const TagTable *table, int audio_hash){
+    // Row of each file plus one, 0 for the files that couldn't be read
+    size_t *rows = (size_t *)calloc(list->count ? list->count : 1, sizeof(size_t));
+    if(!rows){
+        perror("Memory allocation failed");
+        return;
+    }
+
+    for(size_t row = 0; row < table->count; row++){
+        rows[table->file[row]] = row + 1;
+    }
+
+    print_scan_header(stdout, audio_hash);
+    for(size_t i = 0; i < list->count; i++){
+        if(rows[i]){
+            print_tag_row(stdout, table, rows[i] - 1, list->files[i].path);
+        }
+    }
+
+    free(rows);
+}
+
+/**
+ * @brief Adds the rows of the files an interrupted run already scanned, and flags them.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int add_resumed_rows(const ScanList *list, const ScanOptions *options, TagTable *table, char *resumed){
+    for(size_t i = 0; i < list->count; i++){
+        int status;
+        const unsigned char *data;
+        size_t length;
+        if(!find_completed(list->files[i].path, &status, &data, &length)){
+            continue;
+        }
+
+        // A record without the hash a --hash run needs is scanned again
+        ScanRecord record;
+        if(decode_scan_record(data, length, &record) && (!options->audio_hash || record.hashed)){
+            if(!add_tag_row(table, i, &record)){
+                free_tag_data(record.data);
+                return FAILURE;
+            }
+            resumed[i] = 1;
+        }
+        free_tag_data(record.data);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Parses the tags of every file of a list on the worker pool into one table.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int scan_into_table(ScanList *list, const ScanOptions *options, TagTable *table, size_t *failed){
+    unsigned int thread_count = options->thread_count ? options->thread_count : default_worker_count();
+    TagTable *tables = (TagTable *)aligned_alloc(64, thread_count * sizeof(TagTable));
+    char *resumed = (char *)calloc(list->count ? list->count : 1, sizeof(char));
+    if(!tables || !resumed){
+        perror("Memory allocation failed");
+        free(tables);
+        free(resumed);
+        return FAILURE;
+    }
+    for(unsigned int i = 0; i < thread_count; i++){
+        init_tag_table(&tables[i]);
+    }
+
+    ScanJob job = {list, options, tables, resumed, 0};
+    int status = add_resumed_rows(list, options, table, resumed)
+              && run_worker_pool(list->count, thread_count, scan_task, &job) == 0;
+
+    // Single merge at the end, each worker's distinct strings are interned once
+    for(unsigned int i = 0; i < thread_count; i++){
+        if(status && !merge_tag_table(table, &tables[i], 0)){
+            status = FAILURE;
+        }
+        free_tag_table(&tables[i]);
+    }
+    free(tables);
+    free(resumed);
+
+    *failed = job.failed;
+
+    return status;
+}
+
+/**
+ * @brief Scans the tags of every MP3 file under the given paths on a pool of worker threads.
+ * @return 0 if every file could be read, non-zero otherwise.
+ */
+int run_batch_scan(char **paths, int path_count, const ScanOptions *options){
+    ScanList list = {NULL, 0, 0};
+
+    if(!prepare_scan_list(paths, path_count, options, &list)){
+        return 1;
+    }
+
+    TagTable table;
+    size_t failed = 0;
+    init_tag_table(&table);
+
+    int status = scan_into_table(&list, options, &table, &failed);
+    if(status && options->duplicates_only){
+        print_duplicates(&list, &table);
+    }
+    else if(status){
+        print_tag_table(&list, &table, options->audio_hash);
+    }
+
+    free_tag_table(&table);
+    free_scan_list(&list);
+
+    return !status || failed ? 1 : 0;
+}
@@ -0,0 +1,219 @@
+#ifndef BATCH_SCAN_H
+#define BATCH_SCAN_H
+
+#include "main.h"
+#include "id3_utils.h"
+#include "audio_hash.h"
+#include "tag_builder.h"
+
+#define SCAN_ORDER_DIRECTORY 0 /**< Files in the order they are listed/walked */
+#define SCAN_ORDER_INODE 1     /**< Files sorted by inode number */
+#define SCAN_ORDER_PHYSICAL 2  /**< Files sorted by the physical location of their first block */
+
+// Bytes at the start of each file announced to the kernel ahead of parsing, enough for most tags
+#define SCAN_READAHEAD_SIZE (64 * 1024)
+// How many files ahead of the one being parsed get their tag region prefetched
+#define SCAN_PREFETCH_DISTANCE 8
+// Most shards a scan can be split into, --merge keeps one byte of bookkeeping per shard
+#define SCAN_SHARD_MAX 65536
+
+/**
+ * @brief Options of a scan run.
+ */
+typedef struct {
+    int order;                  /**< SCAN_ORDER_* value */
+    unsigned int thread_count;  /**< Number of worker threads (0 selects one per CPU) */
+    int audio_hash;             /**< Add the audio payload hash to every record */
+    int duplicates_only;        /**< Print only groups of files sharing an audio hash */
+    unsigned int shard_index;   /**< Selected shard, 1 to shard_count */
+    unsigned int shard_count;   /**< Number of shards, 0 scans every file */
+} ScanOptions;
+
+/**
+ * @brief One file to scan.
+ */
+typedef struct {
+    char *path;                  /**< Path of the MP3 file */
+    unsigned long long location; /**< Sort key: inode number or physical byte offset */
+} ScanFile;
+
+/**
+ * @brief Growable list of files to scan.
+ */
+typedef struct {
+    ScanFile *files; /**< Files */
+    size_t count;    /**< Number of files */
+    size_t capacity; /**< Number of files allocated */
+} ScanList;
+
+/**
+ * @brief Parsed tag of one scanned file.
+ */
+typedef struct {
+    unsigned char version[2]; /**< Major and revision version, 0 when the file has no ID3v2 tag */
+    unsigned int tag_size;    /**< Size of the tag (excluding the header) */
+    TagData *data;            /**< Text fields, NULL when the file has no ID3v2 tag */
+    TagLayout layout;         /**< Frame, padding and album art sizes */
+    int hashed;               /**< Whether audio_hash was computed */
+    uint64_t audio_hash;      /**< Hash of the audio payload */
+} ScanRecord;
+
+// Columnar table of scanned tags, defined in tag_table.h
+typedef struct TagTable TagTable;
+
+/**
+ * @brief Appends a file to the scan list.
+ *
+ * @param list Scan list.
+ * @param path Path of the file (copied).
+ * @param location Sort key.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int add_scan_file(ScanList *, const char *, unsigned long long);
+
+/**
+ * @brief Collects the MP3 files named on the command line, walking directories recursively.
+ *
+ * @param paths Files and directories.
+ * @param path_count Number of paths.
+ * @param list List receiving the files, in directory order.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int collect_scan_files(char **, int, ScanList *);
+
+/**
+ * @brief Sorts the files by inode number or by physical location (FIEMAP) of their first block.
+ *
+ * Physical ordering falls back to inode ordering when the filesystem can't report extents.
+ */
+void order_scan_files(ScanList *, int);
+
+/**
+ * @brief Frees the files of a scan list.
+ */
+void free_scan_list(ScanList *);
+
+/**
+ * @brief Announces the tag region of a file to the kernel so it is read ahead asynchronously.
+ */
+void prefetch_tag_region(const char *);
+
+/**
+ * @brief Collects and orders the files to scan, and prefetches the first ones.
+ *
+ * With a shard selection, only the files whose path hashes to the selected shard are
+ * kept; the hash depends on the path alone, so every host given the same paths agrees on
+ * the split and the shards get about the same number of files.
+ *
+ * @param paths Files and directories.
+ * @param path_count Number of paths.
+ * @param options Scan options (order).
+ * @param list List receiving the files, in scan order.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int prepare_scan_list(char **, int, const ScanOptions *, ScanList *);
+
+/**
+ * @brief Keeps the prefetch window ahead of the file about to be parsed.
+ *
+ * @param list Files being scanned.
+ * @param index Index of the file about to be parsed.
+ */
+void prefetch_ahead(const ScanList *, size_t);
+
+/**
+ * @brief Reads the tag of one file.
+ *
+ * @param path Path of the MP3 file.
+ * @param record Record receiving the tag.
+ * @param audio_hash Whether to hash the audio payload as well (served from the hash cache when possible).
+ * @return SUCCESS if the file could be read (with or without tag) otherwise FAILURE.
+ */
+int scan_file(const char *, ScanRecord *, int);
+
+/**
+ * @brief Serializes a scan record into a compact byte string (checkpoints of resumable scans).
+ *
+ * Numbers are stored big-endian, followed by the text fields in tag_fields order, each
+ * as a presence byte and a NUL terminated string.
+ *
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int encode_scan_record(TagBuffer *, const ScanRecord *);
+
+/**
+ * @brief Rebuilds a scan record serialized by encode_scan_record.
+ *
+ * The record owns its TagData, released with free_tag_data.
+ *
+ * @return SUCCESS on success, FAILURE if the bytes are malformed.
+ */
+int decode_scan_record(const unsigned char *, size_t, ScanRecord *);
+
+/**
+ * @brief Prints a field value preceded by a tab, replacing tabs and line breaks so a record stays on one line.
+ */
+void print_scan_field(FILE *, const char *);
+
+/**
+ * @brief Prints the header line naming the record columns.
+ */
+void print_scan_header(FILE *, int);
+
+/**
+ * @brief Prints one scan record as a tab separated line.
+ *
+ * The audio_hash column is printed when the record was hashed.
+ */
+void print_scan_record(FILE *, const char *, const ScanRecord *);
+
+/**
+ * @brief Parses an ordering name (directory, inode, physical).
+ * @return SCAN_ORDER_* value, -1 if the name is unknown.
+ */
+int parse_scan_order(const char *);
+
+/**
+ * @brief Parses a shard selection "i/N" (1 <= i <= N <= SCAN_SHARD_MAX).
+ * @return SUCCESS on success, FAILURE if the text isn't a valid selection.
+ */
+int parse_scan_shard(const char *, unsigned int *, unsigned int *);
+
+/**
+ * @brief Parses the tags of every file of a list on the worker pool into one table.
+ *
+ * Each worker fills its own table without locking, the tables are merged once at the end.
+ *
+ * @param list Files to scan.
+ * @param options Scan options (threads, audio hash).
+ * @param table Initialized table receiving one row per file that could be read.
+ * @param failed Receives the number of files that couldn't be read.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int scan_into_table(ScanList *, const ScanOptions *, TagTable *, size_t *);
+
+/**
+ * @brief Prints the rows of a table in scan order, as tab separated records under a header line.
+ *
+ * @param list Files the row file indexes refer to.
+ * @param table Scanned files.
+ * @param audio_hash Whether the header names the audio_hash column.
+ */
+void print_tag_table(const ScanList *, const TagTable *, int);
+
+/**
+ * @brief Prints every group of files sharing the same audio hash, one "hash<TAB>path" line per file.
+ */
+void print_duplicates(const ScanList *, const TagTable *);
+
+/**
+ * @brief Scans the tags of every MP3 file under the given paths on a pool of worker threads.
+ *
+ * @param paths Files and directories.
+ * @param path_count Number of paths.
+ * @param options Scan options.
+ * @return 0 if every file could be read, non-zero otherwise.
+ */
+int run_batch_scan(char **, int, const ScanOptions *);
+
+#endif // BATCH_SCAN_H
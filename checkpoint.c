@@ -0,0 +1,539 @@
+/**
+ * @file checkpoint.c
+ * @brief Progress checkpoint and edit journal of batch runs, used by --resume.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+#include "id3_writer.h"
+#include "error_handling.h"
+
+#define RECORD_COMPLETED 'D' /**< File done: status and data */
+#define RECORD_BEGIN 'B'     /**< Edit started: file size and tag region before the edit */
+#define RECORD_REBUILT 'R'   /**< Rebuilt copy complete: its size and path */
+#define RECORD_END 'E'       /**< Edit finished */
+
+#define EDIT_IDLE 0          /**< No edit in flight */
+#define EDIT_BEGUN 1         /**< Edit started, original possibly modified */
+#define EDIT_REBUILT 2       /**< Rebuilt copy complete, original being replaced */
+
+/**
+ * @brief What the checkpoint says about one file.
+ */
+typedef struct {
+    char *path;                  /**< File path, NULL marks an empty slot */
+    int completed;               /**< Whether the file is done */
+    int status;                  /**< Recorded outcome */
+    unsigned char *data;         /**< Recorded data */
+    size_t length;               /**< Length of the data */
+    int edit_state;              /**< EDIT_* state of the last edit journaled */
+    long image_offset;           /**< Offset of the journaled tag region in the checkpoint */
+    size_t image_length;         /**< Length of the journaled tag region */
+    unsigned long long file_size;/**< File size before the edit */
+    char *rebuilt_path;          /**< Rebuilt copy */
+    unsigned long long rebuilt_size; /**< Size of the rebuilt copy */
+} CheckpointEntry;
+
+/**
+ * @brief The open checkpoint.
+ */
+typedef struct {
+    FILE *file;                 /**< Checkpoint opened for appending */
+    char *path;                 /**< Checkpoint path */
+    CheckpointEntry *entries;   /**< Files of the resumed run (open addressing by path) */
+    size_t capacity;            /**< Number of slots (power of two) */
+    size_t count;               /**< Number of used slots */
+    unsigned int unflushed;     /**< Records written since the last flush */
+    struct timespec flushed;    /**< Time of the last flush */
+} Checkpoint;
+
+static Checkpoint checkpoint;
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief FNV-1a hash of a path.
+ */
+static size_t hash_path(const char *path){
+    size_t hash = 14695981039346656037ULL;
+    for(; *path; path++){
+        hash = (hash ^ (unsigned char)*path) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Returns the slot of a path, either holding it or empty.
+ */
+static CheckpointEntry *find_entry(const char *path){
+    size_t mask = checkpoint.capacity - 1;
+    size_t slot = hash_path(path) & mask;
+
+    while(checkpoint.entries[slot].path && strcmp(checkpoint.entries[slot].path, path) != 0){
+        slot = (slot + 1) & mask;
+    }
+
+    return &checkpoint.entries[slot];
+}
+
+/**
+ * @brief Returns the entry of a path, adding it if needed.
+ * @return Entry, NULL on allocation failure.
+ */
+static CheckpointEntry *add_entry(const char *path){
+    if((checkpoint.count + 1) * 2 > checkpoint.capacity){
+        size_t old_capacity = checkpoint.capacity;
+        CheckpointEntry *old_entries = checkpoint.entries;
+
+        checkpoint.capacity = old_capacity ? old_capacity * 2 : 1024;
+        checkpoint.entries = (CheckpointEntry *)calloc(checkpoint.capacity, sizeof(CheckpointEntry));
+        if(!checkpoint.entries){
+            perror("Memory allocation failed");
+            checkpoint.entries = old_entries;
+            checkpoint.capacity = old_capacity;
+            return NULL;
+        }
+
+        for(size_t i = 0; i < old_capacity; i++){
+            if(old_entries[i].path){
+                *find_entry(old_entries[i].path) = old_entries[i];
+            }
+        }
+        free(old_entries);
+    }
+
+    CheckpointEntry *entry = find_entry(path);
+    if(!entry->path){
+        if(!(entry->path = strdup(path))){
+            perror("Memory allocation failed");
+            return NULL;
+        }
+        checkpoint.count++;
+    }
+
+    return entry;
+}
+
+/**
+ * @brief Frees the entries of the resumed run.
+ */
+static void free_entries(void){
+    for(size_t i = 0; i < checkpoint.capacity; i++){
+        free(checkpoint.entries[i].path);
+        free(checkpoint.entries[i].data);
+        free(checkpoint.entries[i].rebuilt_path);
+    }
+    free(checkpoint.entries);
+    checkpoint.entries = NULL;
+    checkpoint.capacity = checkpoint.count = 0;
+}
+
+/**
+ * @brief Appends one record: a header line, then the path and the data as they are.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int write_record(FILE *file, char type, int status, const char *path, const unsigned char *data, size_t length, unsigned long long value){
+    size_t path_length = strlen(path);
+
+    return fprintf(file, "%c %d %zu %zu %llu\n", type, status, path_length, length, value) > 0
+        && fwrite(path, 1, path_length, file) == path_length
+        && (length == 0 || fwrite(data, 1, length, file) == length);
+}
+
+/**
+ * @brief Reads the checkpoint of the interrupted run into the entries.
+ *
+ * A record cut short by the interruption ends the reading.
+ *
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int load_records(FILE *file){
+    char line[128];
+
+    while(fgets(line, sizeof(line), file)){
+        char type;
+        int status;
+        size_t path_length, length;
+        unsigned long long value;
+        if(sscanf(line, "%c %d %zu %zu %llu", &type, &status, &path_length, &length, &value) != 5 || path_length == 0 || path_length >= FILENAME_MAX){
+            break;
+        }
+
+        char path[FILENAME_MAX];
+        if(fread(path, 1, path_length, file) != path_length){
+            break;
+        }
+        path[path_length] = '\0';
+
+        CheckpointEntry *entry = add_entry(path);
+        if(!entry){
+            return FAILURE;
+        }
+
+        long data_offset = ftell(file);
+        unsigned char *data = NULL;
+
+        // Only completion data and rebuilt paths are kept, tag regions are read back when needed
+        if(type == RECORD_COMPLETED || type == RECORD_REBUILT){
+            data = (unsigned char *)malloc(length + 1);
+            if(!data){
+                perror("Memory allocation failed");
+                return FAILURE;
+            }
+            if(fread(data, 1, length, file) != length){
+                free(data);
+                break;
+            }
+            data[length] = '\0';
+        }
+        else if(fseek(file, length, SEEK_CUR) != 0){
+            break;
+        }
+
+        switch(type){
+            case RECORD_COMPLETED:
+                free(entry->data);
+                entry->completed = 1;
+                entry->status = status;
+                entry->data = data;
+                entry->length = length;
+                entry->edit_state = EDIT_IDLE;
+                break;
+            case RECORD_BEGIN:
+                entry->edit_state = EDIT_BEGUN;
+                entry->image_offset = data_offset;
+                entry->image_length = length;
+                entry->file_size = value;
+                break;
+            case RECORD_REBUILT:
+                free(entry->rebuilt_path);
+                entry->edit_state = EDIT_REBUILT;
+                entry->rebuilt_path = (char *)data;
+                entry->rebuilt_size = value;
+                break;
+            case RECORD_END:
+                entry->edit_state = EDIT_IDLE;
+                break;
+            default:
+                free(data);
+                return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Puts back the tag region journaled before an interrupted edit.
+ *
+ * When the edit had already moved the audio with fallocate, the move is undone first.
+ *
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int roll_back_edit(FILE *file, const CheckpointEntry *entry){
+    unsigned char *image = (unsigned char *)malloc(entry->image_length ? entry->image_length : 1);
+    if(!image){
+        perror("Memory allocation failed");
+        return FAILURE;
+    }
+
+    if(fseek(file, entry->image_offset, SEEK_SET) != 0 || fread(image, 1, entry->image_length, file) != entry->image_length){
+        free(image);
+        return FAILURE;
+    }
+
+    int fd = open(entry->path, O_RDWR);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0){
+        if(fd >= 0){
+            close(fd);
+        }
+        free(image);
+        return FAILURE;
+    }
+
+    int status = SUCCESS;
+    unsigned long long size = info.st_size;
+    if(size > entry->file_size){
+        status = fallocate(fd, FALLOC_FL_COLLAPSE_RANGE, 0, size - entry->file_size) == 0;
+    }
+    else if(size < entry->file_size){
+        status = fallocate(fd, FALLOC_FL_INSERT_RANGE, 0, entry->file_size - size) == 0;
+    }
+
+    if(status){
+        status = pwrite(fd, image, entry->image_length, 0) == (ssize_t)entry->image_length && fsync(fd) == 0;
+    }
+
+    close(fd);
+    free(image);
+
+    return status;
+}
+
+/**
+ * @brief Completes or rolls back the edits the interrupted run left in flight.
+ * @return SUCCESS if every file is consistent again, otherwise FAILURE.
+ */
+static int recover_edits(FILE *file){
+    int status = SUCCESS;
+
+    for(size_t i = 0; i < checkpoint.capacity; i++){
+        CheckpointEntry *entry = &checkpoint.entries[i];
+        if(!entry->path || entry->edit_state == EDIT_IDLE){
+            continue;
+        }
+
+        if(entry->edit_state == EDIT_REBUILT){
+            struct stat info;
+            if(stat(entry->rebuilt_path, &info) != 0){
+                // The copy is only removed once it has replaced the original
+                fprintf(stderr, "Interrupted edit of %s had completed\n", entry->path);
+            }
+            else if((unsigned long long)info.st_size == entry->rebuilt_size && copy_to_original_file(entry->path, entry->rebuilt_path) == 0){
+                fprintf(stderr, "Completed interrupted edit of %s\n", entry->path);
+            }
+            else{
+                fprintf(stderr, "Could not complete interrupted edit of %s, its rebuilt copy is %s\n", entry->path, entry->rebuilt_path);
+                status = FAILURE;
+            }
+        }
+        else if(roll_back_edit(file, entry)){
+            fprintf(stderr, "Rolled back interrupted edit of %s\n", entry->path);
+        }
+        else{
+            fprintf(stderr, "Could not roll back interrupted edit of %s\n", entry->path);
+            status = FAILURE;
+        }
+
+        entry->edit_state = EDIT_IDLE;
+    }
+
+    return status;
+}
+
+/**
+ * @brief Rewrites the checkpoint with only the completed records, atomically.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int compact_checkpoint(void){
+    char tmp_path[FILENAME_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", checkpoint.path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if(!file){
+        perror("Failed to open checkpoint");
+        return FAILURE;
+    }
+
+    int status = SUCCESS;
+    for(size_t i = 0; i < checkpoint.capacity && status; i++){
+        const CheckpointEntry *entry = &checkpoint.entries[i];
+        if(entry->path && entry->completed){
+            status = write_record(file, RECORD_COMPLETED, entry->status, entry->path, entry->data, entry->length, 0);
+        }
+    }
+
+    if(fflush(file) != 0 || fsync(fileno(file)) != 0){
+        status = FAILURE;
+    }
+    if(fclose(file) != 0 || !status || rename(tmp_path, checkpoint.path) != 0){
+        perror("Failed to write checkpoint");
+        remove(tmp_path);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Opens the checkpoint of a batch run.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int open_checkpoint(const char *path, int resume){
+    if(!(checkpoint.path = strdup(path))){
+        perror("Memory allocation failed");
+        return FAILURE;
+    }
+
+    if(resume){
+        FILE *file = fopen(path, "rb");
+        if(!file){
+            perror("Failed to open checkpoint");
+            close_checkpoint();
+            return FAILURE;
+        }
+
+        int status = load_records(file) && recover_edits(file);
+        fclose(file);
+
+        if(!status || !compact_checkpoint()){
+            close_checkpoint();
+            return FAILURE;
+        }
+    }
+
+    checkpoint.file = fopen(path, resume ? "ab" : "wb");
+    if(!checkpoint.file){
+        perror("Failed to open checkpoint");
+        close_checkpoint();
+        return FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &checkpoint.flushed);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Flushes and closes the checkpoint, freeing the completed records.
+ */
+void close_checkpoint(void){
+    if(checkpoint.file){
+        fflush(checkpoint.file);
+        fsync(fileno(checkpoint.file));
+        fclose(checkpoint.file);
+        checkpoint.file = NULL;
+    }
+
+    free_entries();
+    free(checkpoint.path);
+    checkpoint.path = NULL;
+}
+
+/**
+ * @brief Tells whether a checkpoint is open.
+ */
+int checkpoint_enabled(void){
+    return checkpoint.file != NULL;
+}
+
+/**
+ * @brief Looks up a file completed by an earlier run.
+ * @return SUCCESS if the file was completed, otherwise FAILURE.
+ */
+int find_completed(const char *path, int *status, const unsigned char **data, size_t *length){
+    if(checkpoint.capacity == 0){
+        return FAILURE;
+    }
+
+    const CheckpointEntry *entry = find_entry(path);
+    if(!entry->path || !entry->completed){
+        return FAILURE;
+    }
+
+    *status = entry->status;
+    if(data){
+        *data = entry->data;
+    }
+    if(length){
+        *length = entry->length;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Records a completed file (flushed periodically).
+ */
+void record_completed(const char *path, int status, const unsigned char *data, size_t length){
+    if(!checkpoint.file){
+        return;
+    }
+
+    pthread_mutex_lock(&checkpoint_lock);
+
+    write_record(checkpoint.file, RECORD_COMPLETED, status, path, data, length, 0);
+
+    // Losing the last records only means redoing those files, they are not synced
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed_ms = (now.tv_sec - checkpoint.flushed.tv_sec) * 1000 + (now.tv_nsec - checkpoint.flushed.tv_nsec) / 1000000;
+    if(++checkpoint.unflushed >= CHECKPOINT_FLUSH_RECORDS || elapsed_ms >= CHECKPOINT_FLUSH_MS){
+        fflush(checkpoint.file);
+        checkpoint.unflushed = 0;
+        checkpoint.flushed = now;
+    }
+
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+/**
+ * @brief Writes a journal record and makes sure it is on disk.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int write_journal_record(char type, const char *path, const unsigned char *data, size_t length, unsigned long long value){
+    pthread_mutex_lock(&checkpoint_lock);
+    int status = write_record(checkpoint.file, type, 0, path, data, length, value) && fflush(checkpoint.file) == 0;
+    pthread_mutex_unlock(&checkpoint_lock);
+
+    // Syncing outside the lock lets other workers append meanwhile, fdatasync covers everything written so far
+    return status && fdatasync(fileno(checkpoint.file)) == 0;
+}
+
+/**
+ * @brief Journals the tag region of a file before it is modified, synced to disk.
+ * @return SUCCESS on success (or without checkpoint), FAILURE if the file must not be modified.
+ */
+int journal_begin(const char *path, int fd, unsigned long long region_length){
+    if(!checkpoint.file){
+        return SUCCESS;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0){
+        return FAILURE;
+    }
+    if(region_length > (unsigned long long)info.st_size){
+        region_length = info.st_size;
+    }
+
+    unsigned char *image = (unsigned char *)malloc(region_length ? region_length : 1);
+    if(!image){
+        perror("Memory allocation failed");
+        return FAILURE;
+    }
+
+    int status = pread(fd, image, region_length, 0) == (ssize_t)region_length
+              && write_journal_record(RECORD_BEGIN, path, image, region_length, info.st_size);
+    free(image);
+
+    if(!status){
+        fprintf(stderr, "Could not journal %s, file left unchanged\n", path);
+    }
+
+    return status;
+}
+
+/**
+ * @brief Journals that the rebuilt copy of a file is complete and synced, before it replaces the original.
+ * @return SUCCESS on success (or without checkpoint) otherwise FAILURE.
+ */
+int journal_rebuilt(const char *path, const char *rebuilt_path){
+    if(!checkpoint.file){
+        return SUCCESS;
+    }
+
+    struct stat info;
+    if(stat(rebuilt_path, &info) != 0){
+        return FAILURE;
+    }
+
+    return write_journal_record(RECORD_REBUILT, path, (const unsigned char *)rebuilt_path, strlen(rebuilt_path), info.st_size);
+}
+
+/**
+ * @brief Journals that the modification of a file is complete.
+ */
+void journal_end(const char *path){
+    if(!checkpoint.file){
+        return;
+    }
+
+    pthread_mutex_lock(&checkpoint_lock);
+    write_record(checkpoint.file, RECORD_END, 0, path, NULL, 0, 0);
+    pthread_mutex_unlock(&checkpoint_lock);
+}
@@ -0,0 +1,76 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "main.h"
+
+// Completed records are flushed at least this often, or every CHECKPOINT_FLUSH_RECORDS records
+#define CHECKPOINT_FLUSH_MS 1000
+#define CHECKPOINT_FLUSH_RECORDS 256
+
+/**
+ * @brief Opens the checkpoint of a batch run (--checkpoint file [--resume]).
+ *
+ * The checkpoint is an append-only file. It records each completed file with its
+ * outcome (and, for scans, the parsed record), and a journal of the edits in flight:
+ * a copy of the tag region taken before a file is modified, and a marker once the
+ * rebuilt copy of a file is complete.
+ *
+ * Without resume the file is started afresh. With resume, edits left in flight by the
+ * interrupted run are completed (rebuilt copy already written) or rolled back (tag
+ * region restored), the completed files are loaded so the run skips them, and the file
+ * is compacted to the completed records before new ones are appended.
+ *
+ * @param path Checkpoint file.
+ * @param resume Whether to continue the run recorded in the file.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int open_checkpoint(const char *, int);
+
+/**
+ * @brief Flushes and closes the checkpoint, freeing the completed records.
+ */
+void close_checkpoint(void);
+
+/**
+ * @brief Tells whether a checkpoint is open.
+ */
+int checkpoint_enabled(void);
+
+/**
+ * @brief Looks up a file completed by an earlier run.
+ *
+ * @param path File path as given to the batch run.
+ * @param status Receives the recorded outcome.
+ * @param data Receives the recorded data (valid until close_checkpoint), may be NULL.
+ * @param length Receives the length of the data, may be NULL.
+ * @return SUCCESS if the file was completed, otherwise FAILURE.
+ */
+int find_completed(const char *, int *, const unsigned char **, size_t *);
+
+/**
+ * @brief Records a completed file (flushed periodically).
+ */
+void record_completed(const char *, int, const unsigned char *, size_t);
+
+/**
+ * @brief Journals the tag region of a file before it is modified, synced to disk.
+ *
+ * @param path File about to be modified.
+ * @param fd Descriptor of the file.
+ * @param region_length Bytes at the start of the file the edit may overwrite.
+ * @return SUCCESS on success (or without checkpoint), FAILURE if the file must not be modified.
+ */
+int journal_begin(const char *, int, unsigned long long);
+
+/**
+ * @brief Journals that the rebuilt copy of a file is complete and synced, before it replaces the original.
+ * @return SUCCESS on success (or without checkpoint) otherwise FAILURE.
+ */
+int journal_rebuilt(const char *, const char *);
+
+/**
+ * @brief Journals that the modification of a file is complete.
+ */
+void journal_end(const char *);
+
+#endif // CHECKPOINT_H
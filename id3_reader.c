@@ -5,6 +5,7 @@
 #include "id3_utils.h"
 #include "id3_reader.h"
 #include "album_art.h"
+#include "throttle.h"
 #include "error_handling.h" 
 
 /**
@@ -17,8 +18,8 @@ HeaderData *read_id3_header(FILE *file, unsigned int *tag_size){
     fseek(file, 3, SEEK_SET);
     //version is only 2 bytes, so read 2 bytes after tag identifier
     fread(header_data->version, 2, 1, file);
-    //again skip 1 byte for ID3 header flag 
-    fseek(file, 1, SEEK_CUR);
+    //the flags byte tells about unsynchronisation and an extended header
+    fread(&header_data->flags, 1, 1, file);
     //get the size (4 bytes) of the total ID3 tag(excluding the header)
     fread(header_data->size, 4, 1, file);
 
@@ -29,145 +30,127 @@ HeaderData *read_id3_header(FILE *file, unsigned int *tag_size){
 }
 
 /**
- * @brief Reads the ID3 tags from the MP3 file
+ * @brief Reads the whole ID3 tag and collects the text fields.
+ *
+ * The tag is normalized (unsynchronisation, extended header, v2.4 frame sizes) and parsed
+ * from memory. When extract_art is zero the APIC frame is skipped instead of being written
+ * out as an image file, which is what batch modes want.
+ *
  * @return TagData Structure
  */
-TagData *read_id3_tag(FILE *file, unsigned int *tag_size){
-    TagData *data = create_tag_data();
-
-    //To determine how many ID3 frames are there
-    unsigned int remaining_frames = *tag_size;
-
-    // Loop through each frame to extract tag names and content
-    // A frame header is 10 bytes, so ensure at least 10 bytes remain before reading the next frame
-    // This prevents reading into padding, past the end of the tag, or into incomplete/corrupted tag
-    while(remaining_frames > FRAME_HEADER_SIZE){ 
-        unsigned char frame_header[FRAME_HEADER_SIZE];
-        if(fread(frame_header, FRAME_HEADER_SIZE, 1, file) != 1){
-            display_error("Unexpected end of file or read error while reading frame header.\n");
-            break;
-        }
+static TagData *parse_id3_frames(FILE *file, const HeaderData *header_data, unsigned int *tag_size, int extract_art){
+    unsigned char *body = (unsigned char *)malloc(*tag_size ? *tag_size : 1);
+    if(!body){
+        perror("Memory allocation failed");
+        return NULL;
+    }
 
-        // Check if we've reached padding: According to the ID3v2 spec, padding bytes must be $00.
-        // We only check the first few bytes since a valid frame ID must start with non-zero ASCII characters.
-        if (frame_header[0] == 0 || memcmp(frame_header, "\0\0\0\0", 4) == 0) {
-            break;  // Padding or empty frame detected
-        }
-        
-        //The first 4 bytes of frame header has the frame ID
-        char frame_id[5];
-        memcpy(frame_id, frame_header, 4);
-        frame_id[4] = '\0';
-
-        // Validate frame ID: should be ASCII value
-        for (int i = 0; i < 4; i++) {
-            if (frame_id[i] < 0x20 || frame_id[i] > 0x7E) {
-                fprintf(stderr, "Invalid frame ID detected. Possibly corrupted tag.\n");
-                break;
-            }
-        }
+    // A truncated tag is parsed as far as it goes
+    size_t length = fread(body, 1, *tag_size, file);
+    throttle_read(length);
+    if(length < *tag_size){
+        display_error("Unexpected end of file or read error while reading the tag.\n");
+    }
 
-        //The next 4 bytes of frame header contain the frame content size, which is in big endian format(as per ID3v2.3 spec)
-        unsigned int frame_size = (frame_header[4] << 24) | (frame_header[5] << 16) | (frame_header[6] << 8)  | frame_header[7];
+    unsigned char flags = header_data->flags;
+    normalize_tag_body(body, length, header_data->version[0], &flags);
 
-        // Validate frame size against remaining bytes
-        if (frame_size > (remaining_frames - FRAME_HEADER_SIZE)) {
-            display_error("Frame size exceeds remaining tag size. Aborting.\n");
-            break;
-        }
+    TagLayout layout;
+    TagData *data = parse_tag_body(body, length, header_data->version[0], &layout);
 
-        char *content = (char *)calloc(1, frame_size);
-        if (!content) {
+    if(data && extract_art && layout.art_size){
+        // Large enough for "album_art.jpg"/"album_art.png"
+        data->album_art = (char *)calloc(1, 32);
+        if(!data->album_art){
             perror("Memory allocation failed");
+            free_tag_data(data);
+            free(body);
             return NULL;
         }
 
-        if(strcmp(frame_id, "APIC") == 0){
-            data->album_art = (char *)calloc(1, strlen(content));
-            if(!data->album_art){
-                perror("Memory allocation failed");
-                return NULL;
-            }
-            
-            extract_album_art(file, frame_size, data->album_art);
-        }
-        else{
-            //Skipping the text encoding byte(which is the first byte) in the frame content
-            fseek(file, 1, SEEK_CUR);
+        const unsigned char *frame = body + layout.art_offset;
+        unsigned int frame_size = (frame[4] << 24) | (frame[5] << 16) | (frame[6] << 8) | frame[7];
+        extract_album_art(frame + FRAME_HEADER_SIZE, frame_size, data->album_art);
+    }
 
-            fread(content, frame_size - 1, 1, file);
-            content[frame_size - 1] = '\0';
+    free(body);
 
-            if(strcmp(frame_id, "TIT2") == 0){
-                data->title = (char *)calloc(1, strlen(content));
-                if(!data->title){
-                    perror("Memory allocation failed");
-                    return NULL;
-                }
-    
-                strcpy(data->title, content);
-            }
-            else if(strcmp(frame_id, "TPE1") == 0){
-                data->artist = (char *)calloc(1, strlen(content));
-                if(!data->artist){
-                    perror("Memory allocation failed");
-                    return NULL;
-                }
-                
-                strcpy(data->artist, content);
-            }
-            else if(strcmp(frame_id, "TALB") == 0){
-                data->album = (char *)calloc(1, strlen(content));
-                if(!data->album){
-                    perror("Memory allocation failed");
-                    return NULL;
-                }
-                
-                strcpy(data->album, content);
-            }
-            else if(strcmp(frame_id, "TRCK") == 0){
-                data->track = (char *)calloc(1, strlen(content));
-                if(!data->track){
-                    perror("Memory allocation failed");
-                    return NULL;
-                }
-                
-                strcpy(data->track, content);
-            }
-            else if(strcmp(frame_id, "TYER") == 0){
-                data->year = (char *)calloc(1, strlen(content));
-                if(!data->year){
-                    perror("Memory allocation failed");
-                    return NULL;
-                }
-                
-                strcpy(data->year, content);
+    return data;
+}
+
+/**
+ * @brief Reads the ID3 tags from the MP3 file
+ * @return TagData Structure
+ */
+TagData *read_id3_tag(FILE *file, const HeaderData *header_data, unsigned int *tag_size){
+    return parse_id3_frames(file, header_data, tag_size, 1);
+}
+
+/**
+ * @brief Reads only the text frames of the ID3 tag, skipping album art extraction
+ * @return TagData Structure
+ */
+TagData *read_id3_text_frames(FILE *file, const HeaderData *header_data, unsigned int *tag_size){
+    return parse_id3_frames(file, header_data, tag_size, 0);
+}
+
+/**
+ * @brief Parses the text frames of a tag already in memory.
+ * @return TagData Structure
+ */
+TagData *parse_tag_body(const unsigned char *body, unsigned int tag_size, unsigned char version, TagLayout *layout){
+    TagData *data = create_tag_data();
+    if(!data){
+        perror("Memory allocation failed");
+        return NULL;
+    }
+
+    TagLayout counted = {0, 0, 0, 0};
+    unsigned int position = 0;
+
+    // Frames of a normalized body: plain big-endian sizes, padding starts with a zero byte
+    while(tag_size - position > FRAME_HEADER_SIZE && body[position] != 0){
+        const unsigned char *frame_header = body + position;
+        unsigned int frame_size = (frame_header[4] << 24) | (frame_header[5] << 16) | (frame_header[6] << 8) | frame_header[7];
+
+        if(frame_size > tag_size - position - FRAME_HEADER_SIZE){
+            break;
+        }
+
+        if(memcmp(frame_header, "APIC", 4) == 0){
+            if(!counted.art_size){
+                counted.art_offset = position;
             }
-            else if(strcmp(frame_id, "TCON") == 0){
-                data->genre = (char *)calloc(1, strlen(content));
-                if(!data->genre){
-                    perror("Memory allocation failed");
-                    return NULL;
+            counted.art_size += FRAME_HEADER_SIZE + frame_size;
+        }
+        else if(frame_size > 0){
+            for(int i = 0; i < TAG_FIELD_COUNT; i++){
+                if(memcmp(frame_header, tag_field_frame_id(&tag_fields[i], version), 4) != 0){
+                    continue;
                 }
-                
-                strcpy(data->genre, content);
-            }
-            else if(strcmp(frame_id, "COMM") == 0){
-                data->comment = (char *)calloc(1, strlen(content));
-                if(!data->comment){
+
+                // Skip the text encoding byte, the content isn't null terminated in the tag
+                char *content = strndup((const char *)frame_header + FRAME_HEADER_SIZE + 1, frame_size - 1);
+                if(!content){
                     perror("Memory allocation failed");
+                    free_tag_data(data);
                     return NULL;
                 }
-                
-                strcpy(data->comment, content);
+
+                char **slot = tag_field_value(data, tag_fields[i].option);
+                free(*slot);
+                *slot = content;
+                break;
             }
         }
 
-        // Deduct total size of frame (header + content)
-        remaining_frames = remaining_frames - (frame_size + FRAME_HEADER_SIZE);
+        position += FRAME_HEADER_SIZE + frame_size;
+        counted.frame_count++;
+    }
 
-        free(content);
-        content = NULL;
+    counted.frames_length = position;
+    if(layout){
+        *layout = counted;
     }
 
     return data;
@@ -211,7 +194,7 @@ void view_tags(const char *filename){
         display_error("Failed to read ID3 header.");
         return;
     }
-    TagData *data = read_id3_tag(file, &tag_size);
+    TagData *data = read_id3_tag(file, header_data, &tag_size);
     if (!data) {
         display_error("Failed to read ID3 frame.");
         return;
@@ -14,7 +14,24 @@ HeaderData *read_id3_header(FILE *, unsigned int *);
  * @brief Reads the ID3 tags from the MP3 file
  * @return TagData Structure
  */
-TagData *read_id3_tag(FILE *, unsigned int *);
+TagData *read_id3_tag(FILE *, const HeaderData *, unsigned int *);
+
+/**
+ * @brief Reads only the text frames of the ID3 tag, skipping album art extraction
+ * @return TagData Structure
+ */
+TagData *read_id3_text_frames(FILE *, const HeaderData *, unsigned int *);
+
+/**
+ * @brief Parses the text frames of a tag already in memory.
+ *
+ * @param body The tag without the 10 byte header, as left by normalize_tag_body.
+ * @param tag_size Size of the tag.
+ * @param version ID3v2 major version of the tag, selects the frame IDs of the fields.
+ * @param layout Filled with the frame/padding/album art sizes, may be NULL.
+ * @return TagData Structure
+ */
+TagData *parse_tag_body(const unsigned char *, unsigned int, unsigned char, TagLayout *);
 
 /**
  * @brief Displays the MP3 details
@@ -1,4 +1,22 @@
 #include "id3_utils.h"
+#include "error_handling.h"
+
+const TagField tag_fields[TAG_FIELD_COUNT] = {
+    {'t', "TIT2", "TIT2", "title"},
+    {'T', "TRCK", "TRCK", "track"},
+    {'a', "TPE1", "TPE1", "artist"},
+    {'A', "TALB", "TALB", "album"},
+    {'y', "TYER", "TDRC", "year"},
+    {'c', "COMM", "COMM", "comment"},
+    {'g', "TCON", "TCON", "genre"},
+};
+
+/**
+ * @brief Returns the frame ID holding a field in a tag of the given major version.
+ */
+const char *tag_field_frame_id(const TagField *field, unsigned char version){
+    return version == 4 ? field->v24_frame_id : field->frame_id;
+}
 
 /**
  * @brief Decodes a sync-safe integer used in ID3 tag size.
@@ -29,6 +47,200 @@ void encode_syncsafe(unsigned int value, unsigned char *output){
     output[3] = value & 0x7f;
 }
 
+/**
+ * @brief Reads a plain 32 bit big-endian integer.
+ */
+static unsigned int read_be32(const unsigned char *bytes){
+    return ((unsigned int)bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+/**
+ * @brief Writes a plain 32 bit big-endian integer.
+ */
+static void write_be32(unsigned int value, unsigned char *bytes){
+    bytes[0] = (value >> 24) & 0xFF;
+    bytes[1] = (value >> 16) & 0xFF;
+    bytes[2] = (value >> 8) & 0xFF;
+    bytes[3] = value & 0xFF;
+}
+
+/**
+ * @brief Removes unsynchronisation in place: every 0xFF 0x00 pair becomes 0xFF.
+ * @return Length of the decoded data.
+ */
+size_t remove_unsync(unsigned char *data, size_t length){
+    unsigned char *end = data + length;
+    unsigned char *read = data;
+    unsigned char *write = data;
+    unsigned char *marker;
+
+    // Runs between 0xFF bytes are moved in one piece, nothing moves until the first 0xFF 0x00
+    while((marker = memchr(read, 0xFF, end - read)) != NULL){
+        size_t run = marker + 1 - read;
+        if(write != read){
+            memmove(write, read, run);
+        }
+        write += run;
+        read = marker + 1;
+
+        if(read < end && *read == 0x00){
+            read++;
+        }
+    }
+
+    if(write != read){
+        memmove(write, read, end - read);
+    }
+
+    return write + (end - read) - data;
+}
+
+/**
+ * @brief Checks whether a frame (or the padding, or the end of the tag) can start at a position.
+ */
+static int frame_starts_at(const unsigned char *body, unsigned int position, unsigned int length){
+    if(position == length || (position < length && body[position] == 0)){
+        return 1;
+    }
+    if(position > length || length - position < 4){
+        return 0;
+    }
+
+    for(int i = 0; i < 4; i++){
+        unsigned char c = body[position + i];
+        if(!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))){
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Decodes the size of an ID3v2.4 frame.
+ *
+ * The sizes are syncsafe, but some encoders wrote plain big-endian sizes in v2.4 tags;
+ * the plain size is used when the syncsafe one doesn't land on a frame boundary and the
+ * plain one does.
+ */
+static unsigned int v24_frame_size(const unsigned char *body, unsigned int position, unsigned int length){
+    const unsigned char *size = body + position + 4;
+    unsigned int plain = read_be32(size);
+
+    if((size[0] | size[1] | size[2] | size[3]) & 0x80){
+        return plain;
+    }
+
+    unsigned int syncsafe = decode_syncsafe((unsigned char *)size);
+    if(syncsafe != plain && !frame_starts_at(body, position + FRAME_HEADER_SIZE + syncsafe, length)
+       && frame_starts_at(body, position + FRAME_HEADER_SIZE + plain, length)){
+        return plain;
+    }
+
+    return syncsafe;
+}
+
+/**
+ * @brief Normalizes the frames of an ID3v2.4 tag in place.
+ * @return Number of bytes used by the frames and whatever followed them.
+ */
+static unsigned int normalize_v24_frames(unsigned char *body, unsigned int length, int unsync_all){
+    unsigned int read = 0, write = 0;
+
+    while(length - read > FRAME_HEADER_SIZE && body[read] != 0){
+        unsigned int size = v24_frame_size(body, read, length);
+        if(size > length - read - FRAME_HEADER_SIZE){
+            break;
+        }
+
+        unsigned char frame_header[FRAME_HEADER_SIZE];
+        memcpy(frame_header, body + read, FRAME_HEADER_SIZE);
+
+        unsigned char *content = body + read + FRAME_HEADER_SIZE;
+        unsigned int content_size = size;
+        unsigned char format = frame_header[9];
+
+        // Compressed or encrypted frames are opaque, they are kept as they are
+        if(!(format & (FRAME_FLAG_COMPRESSED | FRAME_FLAG_ENCRYPTED))){
+            unsigned int group = (format & FRAME_FLAG_GROUPING) ? 1 : 0;
+
+            if((format & FRAME_FLAG_DATA_LENGTH) && content_size >= group + 4){
+                memmove(content + group, content + group + 4, content_size - group - 4);
+                content_size -= 4;
+            }
+            if(((format & FRAME_FLAG_UNSYNC) || unsync_all) && content_size > group){
+                content_size = group + remove_unsync(content + group, content_size - group);
+            }
+
+            frame_header[9] = format & ~(FRAME_FLAG_UNSYNC | FRAME_FLAG_DATA_LENGTH);
+        }
+
+        write_be32(content_size, frame_header + 4);
+        memcpy(body + write, frame_header, FRAME_HEADER_SIZE);
+        memmove(body + write + FRAME_HEADER_SIZE, content, content_size);
+
+        write += FRAME_HEADER_SIZE + content_size;
+        read += FRAME_HEADER_SIZE + size;
+    }
+
+    // Padding, or bytes that don't parse as frames, follow unchanged
+    memmove(body + write, body + read, length - read);
+
+    return write + (length - read);
+}
+
+/**
+ * @brief Turns a tag body into the form every frame walker of the program expects.
+ */
+void normalize_tag_body(unsigned char *body, unsigned int length, unsigned char version, unsigned char *flags){
+    unsigned int used = length;
+
+    // Before v2.4 the whole tag is unsynchronised and frame sizes count the decoded bytes
+    if(version < 4 && (*flags & TAG_FLAG_UNSYNC)){
+        used = remove_unsync(body, length);
+    }
+
+    if((*flags & TAG_FLAG_EXTENDED) && used >= 4){
+        // The v2.4 size covers the whole extended header, the v2.3 one excludes its own 4 bytes
+        unsigned int extended_size = version >= 4 ? decode_syncsafe(body) : read_be32(body) + 4;
+        if(extended_size > used){
+            extended_size = used;
+        }
+        memmove(body, body + extended_size, used - extended_size);
+        used -= extended_size;
+    }
+
+    if(version >= 4){
+        used = normalize_v24_frames(body, used, *flags & TAG_FLAG_UNSYNC);
+    }
+
+    memset(body + used, 0, length - used);
+    *flags &= ~(TAG_FLAG_UNSYNC | TAG_FLAG_EXTENDED);
+}
+
+/**
+ * @brief Rewrites the big-endian frame sizes of normalized frames as the given version stores them.
+ * @return SUCCESS on success, FAILURE if a frame is too large for a syncsafe size.
+ */
+int encode_frame_sizes(unsigned char *frames, size_t length, unsigned char version){
+    if(version < 4){
+        return SUCCESS;
+    }
+
+    size_t position = 0;
+    while(position + FRAME_HEADER_SIZE <= length && frames[position] != 0){
+        unsigned int size = read_be32(frames + position + 4);
+        if(size >= (1U << 28) || size > length - position - FRAME_HEADER_SIZE){
+            return FAILURE;
+        }
+
+        encode_syncsafe(size, frames + position + 4);
+        position += FRAME_HEADER_SIZE + size;
+    }
+
+    return SUCCESS;
+}
+
 /**
  * @brief Initializes each field to be displayed for the MP3 file
  * @return Pointer to the TagData structure 
@@ -88,6 +300,7 @@ void free_tag_data(TagData *data) {
         free(data->title);
         free(data->artist);
         free(data->album);
+        free(data->track);
         free(data->year);
         free(data->comment);
         free(data->genre);
@@ -96,3 +309,77 @@ void free_tag_data(TagData *data) {
         free(data);
     }
 }
+
+/**
+ * @brief Looks up an editable field by its option letter.
+ * @return Pointer to the field description, NULL if the letter is unknown.
+ */
+const TagField *find_tag_field(char option){
+    for(int i = 0; i < TAG_FIELD_COUNT; i++){
+        if(tag_fields[i].option == option){
+            return &tag_fields[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Looks up an editable field by name ("title"), option ("-t") or frame ID ("TIT2").
+ * @return Pointer to the field description, NULL if the name is unknown.
+ */
+const TagField *find_tag_field_by_name(const char *name){
+    if(name[0] == '-' && name[1] != '\0' && name[2] == '\0'){
+        return find_tag_field(name[1]);
+    }
+
+    for(int i = 0; i < TAG_FIELD_COUNT; i++){
+        if(strcmp(tag_fields[i].name, name) == 0 || strcmp(tag_fields[i].frame_id, name) == 0
+           || strcmp(tag_fields[i].v24_frame_id, name) == 0){
+            return &tag_fields[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Returns the address of the TagData member holding the field for an option letter.
+ * @return Pointer to the member, NULL if the letter is unknown.
+ */
+char **tag_field_value(TagData *data, char option){
+    switch(option){
+        case 't': return &data->title;
+        case 'T': return &data->track;
+        case 'a': return &data->artist;
+        case 'A': return &data->album;
+        case 'y': return &data->year;
+        case 'c': return &data->comment;
+        case 'g': return &data->genre;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Replaces the value of a field with a copy of the given string.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int set_tag_field(TagData *data, char option, const char *value){
+    char **slot = tag_field_value(data, option);
+    if(!slot){
+        return FAILURE;
+    }
+
+    char *copy = (char *)calloc(strlen(value) + 1, sizeof(char));
+    if(!copy){
+        perror("Memory allocation failed");
+        return FAILURE;
+    }
+    strcpy(copy, value);
+
+    free(*slot);
+    *slot = copy;
+
+    return SUCCESS;
+}
@@ -5,6 +5,20 @@
 
 #define TAG_HEADER_SIZE 10
 #define FRAME_HEADER_SIZE 10
+// Padding left after the frames when a tag has to be rebuilt, so later edits can be done in place
+#define DEFAULT_TAG_PADDING 1024
+// Tag header flags (byte 5)
+#define TAG_FLAG_UNSYNC 0x80    /**< Unsynchronisation applied (whole tag in v2.3, every frame in v2.4) */
+#define TAG_FLAG_EXTENDED 0x40  /**< An extended header follows the tag header */
+#define TAG_FLAG_FOOTER 0x10    /**< ID3v2.4: a copy of the header follows the padding */
+// ID3v2.4 frame format flags (byte 9 of the frame header)
+#define FRAME_FLAG_GROUPING 0x40    /**< A group identifier byte precedes the frame data */
+#define FRAME_FLAG_COMPRESSED 0x08  /**< Frame data is zlib compressed */
+#define FRAME_FLAG_ENCRYPTED 0x04   /**< Frame data is encrypted */
+#define FRAME_FLAG_UNSYNC 0x02      /**< Unsynchronisation applied to the frame data */
+#define FRAME_FLAG_DATA_LENGTH 0x01 /**< A 4 byte syncsafe data length precedes the frame data */
+// Padding beyond which an edit gives the space back to the filesystem (e.g. after stripping album art)
+#define TAG_SHRINK_THRESHOLD (64 * 1024)
 
 /**
  * @brief Structure to hold ID3 header data.
@@ -12,6 +26,7 @@
 typedef struct {
     char *size; /**< Size of the ID3 tag(excluding the ID3 header) */
     char *version; /**< Version of the ID3 tag */
+    unsigned char flags; /**< Header flags (TAG_FLAG_*) */
 } HeaderData;
 
 /**
@@ -28,6 +43,33 @@ typedef struct {
     char *album_art;  /**< Album art data */   
 } TagData;
 
+/**
+ * @brief Structure to hold how the space of an ID3 tag is used.
+ */
+typedef struct {
+    unsigned int frames_length; /**< Bytes taken by the frames, the rest of the tag is padding */
+    unsigned int frame_count;   /**< Number of frames */
+    unsigned int art_size;      /**< Bytes taken by APIC frames (headers included) */
+    unsigned int art_offset;    /**< Offset of the first APIC frame, valid when art_size isn't 0 */
+} TagLayout;
+
+/**
+ * @brief Describes one editable text field of the ID3 tag.
+ */
+typedef struct {
+    char option;          /**< Edit option letter (as in -t, -T, -a, ...) */
+    const char *frame_id;     /**< ID3v2.3 frame ID holding the field */
+    const char *v24_frame_id; /**< ID3v2.4 frame ID holding the field (TDRC replaces TYER) */
+    const char *name;         /**< Field name as used in manifests and reports */
+} TagField;
+
+#define TAG_FIELD_COUNT 7
+
+/**
+ * @brief Table of the editable fields, in the order they are displayed.
+ */
+extern const TagField tag_fields[TAG_FIELD_COUNT];
+
 /**
  * @brief Decodes a sync-safe integer used in ID3 tags.
  *
@@ -50,6 +92,39 @@ unsigned int decode_syncsafe(unsigned char[]);
  */
 void encode_syncsafe(unsigned int, unsigned char *);
 
+/**
+ * @brief Removes unsynchronisation in place: every 0xFF 0x00 pair becomes 0xFF.
+ *
+ * The 0xFF bytes are located with memchr, so a tag without any costs a single scan.
+ *
+ * @return Length of the decoded data.
+ */
+size_t remove_unsync(unsigned char *, size_t);
+
+/**
+ * @brief Turns a tag body into the form every frame walker of the program expects.
+ *
+ * Unsynchronisation is removed (whole tag for v2.3, per frame for v2.4), the extended
+ * header and ID3v2.4 data length indicators are dropped, and ID3v2.4 syncsafe frame sizes
+ * are rewritten as plain big-endian sizes. The body keeps its length, the bytes freed at
+ * the end become padding. The flags of the dropped features are cleared.
+ *
+ * @param body Tag body (without the 10 byte header).
+ * @param length Length of the body.
+ * @param version Major version of the tag.
+ * @param flags Header flags, updated to describe the normalized body.
+ */
+void normalize_tag_body(unsigned char *, unsigned int, unsigned char, unsigned char *);
+
+/**
+ * @brief Rewrites the big-endian frame sizes of normalized frames as the given version stores them.
+ *
+ * ID3v2.4 frame sizes are syncsafe, earlier versions are left as they are.
+ *
+ * @return SUCCESS on success, FAILURE if a frame is too large for a syncsafe size.
+ */
+int encode_frame_sizes(unsigned char *, size_t, unsigned char);
+
 /**
  * @brief Creates a new HeaderData structure.
  * 
@@ -74,4 +149,37 @@ void free_header_data(HeaderData *);
  */
 void free_tag_data(TagData *);
 
+/**
+ * @brief Looks up an editable field by its option letter.
+ * @return Pointer to the field description, NULL if the letter is unknown.
+ */
+const TagField *find_tag_field(char);
+
+/**
+ * @brief Returns the frame ID holding a field in a tag of the given major version.
+ *
+ * @param field Field description.
+ * @param version ID3v2 major version of the tag.
+ * @return 4 character frame ID.
+ */
+const char *tag_field_frame_id(const TagField *, unsigned char);
+
+/**
+ * @brief Looks up an editable field by name ("title"), option ("-t") or frame ID ("TIT2").
+ * @return Pointer to the field description, NULL if the name is unknown.
+ */
+const TagField *find_tag_field_by_name(const char *);
+
+/**
+ * @brief Returns the address of the TagData member holding the field for an option letter.
+ * @return Pointer to the member, NULL if the letter is unknown.
+ */
+char **tag_field_value(TagData *, char);
+
+/**
+ * @brief Replaces the value of a field with a copy of the given string.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int set_tag_field(TagData *, char, const char *);
+
 #endif
\ No newline at end of file
@@ -1,217 +1,583 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/vfs.h>
 #include "main.h"
 #include "id3_utils.h"
 #include "id3_reader.h"
 #include "id3_writer.h"
+#include "audio_hash.h"
+#include "throttle.h"
+#include "checkpoint.h"
 #include "error_handling.h"
 
-void copy_tag_header(FILE *original_file, FILE *tmp_file, unsigned char *tag_header){
-    //read 10 bytes header from the original MP3 file
-    fread(tag_header, TAG_HEADER_SIZE, 1, original_file);
-    //now write these 10 bytes to the temporary file
-    fwrite(tag_header, TAG_HEADER_SIZE, 1, tmp_file);
+/**
+ * @brief Checks whether an edit option string selects the given field.
+ *
+ * A single option ("-t") selects one field, a combined option ("-taA") selects
+ * several fields so that they can be rewritten in one pass.
+ */
+static int option_selects(const char *option, char letter){
+    return option[0] == '-' && strchr(option + 1, letter) != NULL;
 }
 
-unsigned int copy_tag_frames(FILE *original_file, FILE *tmp_file, const unsigned int *tag_size, const char *option, const TagData *data){
-    // This variable stores the total size of all frames written
-    unsigned int total_written_frame_size = 0;
-    unsigned int new_frame_size = 0;
+unsigned int copy_tag_frames(const unsigned char *tag_body, const unsigned int *tag_size, TagBuffer *frames, const char *option, const TagData *data, unsigned char version){
+    // Option letters of the edited fields already written, the others get a new frame at the end
+    char written_options[TAG_FIELD_COUNT + 1] = {0};
+    unsigned int written_count = 0;
 
+    unsigned int position = 0;
     unsigned int remaining_frames = *tag_size;
 
     // Loop through each frame to identify and update the relevant tag frame
     // Ensure at least 10 bytes remain for reading a complete frame header
     while(remaining_frames > FRAME_HEADER_SIZE){
-        unsigned char frame_header[FRAME_HEADER_SIZE];
-        // Read 10 bytes frame header from the original MP3 file
-        if(fread(frame_header, FRAME_HEADER_SIZE, 1, original_file) != 1){
-            display_error("Unexpected end of file or read error while reading frame header.\n");
-            break;
-        }
+        const unsigned char *frame_header = tag_body + position;
 
         // Check if padding is reached (frame ID starts with 0)
         if (frame_header[0] == 0) {
-            // Move the file pointer back by 10 bytes to position it at the start of padding
-            fseek(original_file, -FRAME_HEADER_SIZE, SEEK_CUR);
-            break;  // Padding reached
+            break;  // Padding reached, it's handled in write_id3_tag function
         }
 
         // The first 4 bytes of frame header has the frame ID
-        unsigned char frame_id[5];
+        char frame_id[5];
         memcpy(frame_id, frame_header, 4);
         frame_id[4] = '\0';
 
         // The next 4 bytes of the frame header contain the frame content size
         unsigned int original_frame_size = (frame_header[4] << 24) | (frame_header[5] << 16) | (frame_header[6] << 8)  | frame_header[7];
 
-        // Variables to store edited content and its length
-        char *edited_content = NULL;
-        unsigned int edited_length = 0;
-
-        // Compare frame ID with known tag identifiers and check if the current option matches, also assign corresponding data
-        if(strcmp(frame_id, "TIT2") == 0 && strcmp(option, "-t") == 0){
-            edited_content = data->title;  
-        }
-        else if(strcmp(frame_id, "TRCK") == 0 && strcmp(option, "-T") == 0){
-            edited_content = data->track; 
-        }
-        else if(strcmp(frame_id, "TPE1") == 0 && strcmp(option, "-a") == 0){
-            edited_content = data->artist; 
-        }
-        else if(strcmp(frame_id, "TALB") == 0 && strcmp(option, "-A") == 0){
-            edited_content = data->album;  
-        }
-        else if(strcmp(frame_id, "TYER") == 0 && strcmp(option, "-y") == 0){
-            edited_content = data->year;
-        }
-        else if(strcmp(frame_id, "COMM") == 0 && strcmp(option, "-c") == 0){ 
-            edited_content = data->comment;  
-        }
-        else if(strcmp(frame_id, "TCON") == 0 && strcmp(option, "-g") == 0){
-            edited_content = data->genre; 
+        if (original_frame_size > (remaining_frames - FRAME_HEADER_SIZE)) {
+            display_error("Frame size exceeds remaining tag size. Aborting.\n");
+            return -1;
         }
 
-        // If the current frame is the one being edited
-        if (edited_content) {
-            edited_length = strlen(edited_content);
-            // 1 added to account for the text encoding byte at the start of the frame content
-            new_frame_size = edited_length + 1;
-            // Convert the new frame size to big-endian format (as per ID3v2.3 spec) and store it in edited_frame_size
-            for (int i = 0; i < 4; i++) {
-                frame_header[i + 4] = (new_frame_size >> (24 - (8 * i))) & 0xFF;
+        // Compare frame ID with known tag identifiers and check if the current option selects it, also assign corresponding data
+        const TagField *edited_field = NULL;
+        for(int i = 0; i < TAG_FIELD_COUNT; i++){
+            if(strcmp(frame_id, tag_field_frame_id(&tag_fields[i], version)) == 0 && option_selects(option, tag_fields[i].option)
+               && !strchr(written_options, tag_fields[i].option)){
+                edited_field = &tag_fields[i];
+                break;
             }
-        } 
-
-        // Write the 10 bytes frame header to the temporary file
-        fwrite(frame_header, FRAME_HEADER_SIZE, 1, tmp_file);
-
-        // Read the frame content (including text encoding byte) from the original file and write it to the temp file
-        char *frame_content_buf = (char *)calloc(1, original_frame_size);
-        if (!frame_content_buf) {
-            perror("Memory allocation failed\n");
-            return -1;
         }
+        char *edited_content = edited_field ? *tag_field_value((TagData *)data, edited_field->option) : NULL;
 
-        fread(frame_content_buf, original_frame_size, 1, original_file);
-
-        if(edited_length){
-            // Write encoding byte (first byte of original content)
-            fwrite(frame_content_buf, 1, 1, tmp_file);
-            // Write the new content
-            fwrite(edited_content, edited_length, 1, tmp_file);
-
-            total_written_frame_size = total_written_frame_size + (new_frame_size + FRAME_HEADER_SIZE);
+        int appended;
+        // If the current frame is the one being edited
+        if(edited_content){
+            // Keep the encoding byte (first byte of original content) and write the new content
+            unsigned char encoding = original_frame_size ? frame_header[FRAME_HEADER_SIZE] : 0;
+            appended = append_text_frame(frames, frame_id, encoding, edited_content);
+            written_options[written_count++] = edited_field->option;
         }
         else{
-            fwrite(frame_content_buf, original_frame_size, 1, tmp_file);
-            
-            total_written_frame_size = total_written_frame_size + (original_frame_size + FRAME_HEADER_SIZE);
+            // Copy the 10 bytes frame header and the unchanged content as they are
+            appended = append_tag_bytes(frames, frame_header, FRAME_HEADER_SIZE + original_frame_size);
         }
 
-        free(frame_content_buf);
+        if(!appended){
+            return -1;
+        }
         
         // Deduct total size of frame (header + content)
+        position += original_frame_size + FRAME_HEADER_SIZE;
         remaining_frames = remaining_frames - (original_frame_size + FRAME_HEADER_SIZE);
     }
 
-    // Skipping the padding data (if any) here as it'll be handled in write_id3_tag function
-    fseek(original_file, remaining_frames, SEEK_CUR);
+    // Edited fields which had no frame in the original tag are appended as new frames
+    for(int i = 0; i < TAG_FIELD_COUNT; i++){
+        if(!option_selects(option, tag_fields[i].option) || strchr(written_options, tag_fields[i].option)){
+            continue;
+        }
 
-    return total_written_frame_size;
+        char *value = *tag_field_value((TagData *)data, tag_fields[i].option);
+        if(value && !append_text_frame(frames, tag_field_frame_id(&tag_fields[i], version), 0, value)){
+            return -1;
+        }
+    }
+
+    return frames->length;
 }
 
-void copy_remaining_data(FILE *original_file, FILE *tmp_file){
+int copy_remaining_data(FILE *original_file, FILE *tmp_file, AudioHash *audio_hash, unsigned long long hash_start, unsigned long long hash_end){
     unsigned char remaining_data_buf[BUFSIZ];
     size_t bytes;
+    long start = ftell(original_file);
+    unsigned long long position = start < 0 ? 0 : (unsigned long long)start;
+
+    while((bytes = fread(remaining_data_buf, 1, sizeof(remaining_data_buf), original_file)) > 0){
+        throttle_read(bytes);
+        throttle_write(bytes);
+        // The audio is hashed on its way through, so verifying it costs no extra read;
+        // a v2.4 footer before it and ID3v1/APE tags after it are copied but not hashed
+        if(audio_hash && position + bytes > hash_start && position < hash_end){
+            unsigned long long from = position > hash_start ? position : hash_start;
+            unsigned long long to = position + bytes < hash_end ? position + bytes : hash_end;
+            update_audio_hash(audio_hash, remaining_data_buf + (from - position), to - from);
+        }
+        if(fwrite(remaining_data_buf, 1, bytes, tmp_file) != bytes){
+            perror("Failed to write file");
+            return FAILURE;
+        }
+        position += bytes;
+    }
 
-    while(bytes = (fread(remaining_data_buf, sizeof(remaining_data_buf), 1,original_file)) > 0){
-        fwrite(remaining_data_buf, sizeof(remaining_data_buf), 1, tmp_file);
+    // fread returns 0 on errors as well as at the end of the file
+    if(ferror(original_file) || ferror(tmp_file)){
+        perror("Failed to copy file");
+        return FAILURE;
     }
+
+    return SUCCESS;
 }
 
-void copy_to_original_file(const char *original_filename, const char *tmp_filename){
-    FILE *original_file = fopen(original_filename, "wb");
-    if(!original_file){
+int copy_to_original_file(const char *original_filename, const char *tmp_filename){
+    FILE *tmp_file = fopen(tmp_filename, "rb");
+    if(!tmp_file){
         perror("Failed to open file");
-        return;
+        return 1;
     }
 
-    FILE *tmp_file = fopen(tmp_filename, "rb");
-    if(!tmp_file){
+    FILE *original_file = fopen(original_filename, "wb");
+    if(!original_file){
         perror("Failed to open file");
-        return;
+        fclose(tmp_file);
+        return 1;
     }
 
     unsigned char tmp_data_buf[BUFSIZ];
     size_t bytes;
-
-    while((bytes = fread(tmp_data_buf, sizeof(tmp_data_buf), 1, tmp_file)) > 0){
-        fwrite(tmp_data_buf, sizeof(tmp_data_buf), 1, original_file);
+    int status = 0;
+
+    while((bytes = fread(tmp_data_buf, 1, sizeof(tmp_data_buf), tmp_file)) > 0){
+        throttle_read(bytes);
+        throttle_write(bytes);
+        if(fwrite(tmp_data_buf, 1, bytes, original_file) != bytes){
+            perror("Failed to write file");
+            status = 1;
+            break;
+        }
     }
 
-    fclose(original_file);
+    if(fclose(original_file) != 0){
+        status = 1;
+    }
     fclose(tmp_file);
     
-    // Remove the temp file
-    remove(tmp_filename);
+    // Remove the temp file, unless it is the only complete copy left
+    if(status == 0){
+        remove(tmp_filename);
+    }
+    else{
+        fprintf(stderr, "Failed to replace %s, its rebuilt copy is kept as %s\n", original_filename, tmp_filename);
+    }
+
+    return status;
 }
 
-int write_id3_tag(const char *filename, const TagData *data, const unsigned int *tag_size, const char *option) {
+/**
+ * @brief Writes a whole tag (header, frames and padding) at the start of a file with pwritev.
+ *
+ * Padding comes from a shared zero block, so nothing is allocated for it and a tag
+ * normally goes to disk in a single system call.
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+static int write_tag_vector(int fd, const unsigned char *tag_header, const unsigned char *frames, size_t frames_length, size_t padding){
+    static const unsigned char zero_block[4096];
+    struct iovec vector[64];
+    int count = 0;
+    off_t offset = 0;
+
+    throttle_write(TAG_HEADER_SIZE + frames_length + padding);
+
+    vector[count].iov_base = (void *)tag_header;
+    vector[count++].iov_len = TAG_HEADER_SIZE;
+    if(frames_length){
+        vector[count].iov_base = (void *)frames;
+        vector[count++].iov_len = frames_length;
+    }
+
+    while(count > 0 || padding > 0){
+        // Top up the vector with padding blocks
+        while(padding > 0 && count < (int)(sizeof(vector) / sizeof(vector[0]))){
+            size_t chunk = padding < sizeof(zero_block) ? padding : sizeof(zero_block);
+            vector[count].iov_base = (void *)zero_block;
+            vector[count++].iov_len = chunk;
+            padding -= chunk;
+        }
+
+        ssize_t written = pwritev(fd, vector, count, offset);
+        if(written <= 0){
+            perror("Failed to write tag");
+            return 1;
+        }
+        offset += written;
+
+        // Drop what was written, keeping a partially written entry
+        int done = 0;
+        while(done < count && (size_t)written >= vector[done].iov_len){
+            written -= vector[done++].iov_len;
+        }
+        if(done < count){
+            vector[done].iov_base = (unsigned char *)vector[done].iov_base + written;
+            vector[done].iov_len -= written;
+        }
+        memmove(vector, &vector[done], (count - done) * sizeof(struct iovec));
+        count -= done;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Returns the block size of the filesystem holding a file, 0 if unknown.
+ */
+static size_t filesystem_block_size(int fd){
+    struct statfs info;
+
+    return fstatfs(fd, &info) == 0 && info.f_bsize > 0 ? (size_t)info.f_bsize : 0;
+}
+
+/**
+ * @brief Resizes the tag region by shifting the audio with fallocate, without moving any data.
+ *
+ * Whole filesystem blocks are inserted at (or collapsed from) the start of the file, which
+ * only works on filesystems supporting FALLOC_FL_INSERT_RANGE / FALLOC_FL_COLLAPSE_RANGE
+ * (ext4, XFS). The bytes in front of the audio are garbage afterwards until the new tag is written.
+ *
+ * @param fd File descriptor of the MP3 file.
+ * @param tag_size Current tag size, updated to the new size on success.
+ * @param wanted_size Minimum tag size needed (growing) or the size to shrink towards (shrinking).
+ * @return SUCCESS if the tag region was resized otherwise FAILURE.
+ */
+static int shift_audio(int fd, unsigned int *tag_size, size_t wanted_size){
+    size_t block = filesystem_block_size(fd);
+    if(!block){
+        return FAILURE;
+    }
+
+    if(wanted_size > *tag_size){
+        // Grow by whole blocks, the slack becomes padding
+        size_t grow = (wanted_size - *tag_size + block - 1) / block * block;
+        if(fallocate(fd, FALLOC_FL_INSERT_RANGE, 0, grow) != 0){
+            return FAILURE;
+        }
+        *tag_size += grow;
+
+        return SUCCESS;
+    }
+
+    size_t shrink = (*tag_size - wanted_size) / block * block;
+    if(shrink == 0 || fallocate(fd, FALLOC_FL_COLLAPSE_RANGE, 0, shrink) != 0){
+        return FAILURE;
+    }
+    *tag_size -= shrink;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Rewrites the ID3v2.4 footer after the padding so it matches the new header.
+ * @return 0 on success (or when the tag has no footer), -1 on failure.
+ */
+static int write_tag_footer(int fd, const unsigned char *tag_header, unsigned int tag_size){
+    if(tag_header[3] != 4 || !(tag_header[5] & TAG_FLAG_FOOTER)){
+        return 0;
+    }
+
+    unsigned char footer[TAG_HEADER_SIZE];
+    memcpy(footer, tag_header, TAG_HEADER_SIZE);
+    memcpy(footer, "3DI", 3);
+
+    return pwrite(fd, footer, TAG_HEADER_SIZE, TAG_HEADER_SIZE + tag_size) == TAG_HEADER_SIZE ? 0 : -1;
+}
+
+/**
+ * @brief Stores a new tag, in place when possible, otherwise by rebuilding the file.
+ *
+ * The audio stays where it is when the frames fit in the current tag. When they don't,
+ * or when stripped frames leave more than TAG_SHRINK_THRESHOLD bytes of padding, the
+ * audio is shifted by whole blocks with fallocate; the file is only rebuilt on
+ * filesystems that can't do that.
+ *
+ * @param filename The name of the MP3 file.
+ * @param fd File descriptor of the MP3 file opened for reading and writing.
+ * @param tag_header Header of the new tag, the size bytes are filled in here.
+ * @param frames Serialized frames.
+ * @param frames_length Length of the serialized frames.
+ * @param has_tag Whether the file currently starts with an ID3v2 tag.
+ * @param old_tag_size Size of the current tag (excluding its header).
+ * @return EDIT_IN_PLACE, EDIT_APPLIED or EDIT_FAILED.
+ */
+static int store_tag(const char *filename, int fd, unsigned char *tag_header, const unsigned char *frames, size_t frames_length, int has_tag, unsigned int old_tag_size){
+    // With a hash cache, the audio hash follows the file through the edit and checks the rewrite
+    struct stat identity;
+    uint64_t cached_hash = 0;
+    int hash_known = hash_cache_enabled() && fstat(fd, &identity) == 0 && lookup_audio_hash(&identity, &cached_hash);
+
+    // With a checkpoint, the bytes the edit may overwrite (old tag and footer) are journaled first
+    unsigned long long region_length = has_tag ? TAG_HEADER_SIZE + old_tag_size + TAG_HEADER_SIZE : 0;
+    if(!journal_begin(filename, fd, region_length)){
+        return EDIT_FAILED;
+    }
+
+    unsigned int tag_size = old_tag_size;
+    int fits = has_tag && frames_length <= old_tag_size;
+
+    if(fits && old_tag_size - frames_length > TAG_SHRINK_THRESHOLD){
+        // Give back the space of stripped frames, keeping the usual padding (stays as is if unsupported)
+        shift_audio(fd, &tag_size, frames_length + DEFAULT_TAG_PADDING);
+    }
+    else if(!fits && has_tag){
+        // Make room in front of the audio instead of copying it
+        fits = shift_audio(fd, &tag_size, frames_length + DEFAULT_TAG_PADDING);
+    }
+
+    if(fits){
+        // Case 1: The frames fit, pad the rest of the tag, the audio is not touched
+        encode_syncsafe(tag_size, &tag_header[6]);
+
+        if(write_tag_vector(fd, tag_header, frames, frames_length, tag_size - frames_length) != 0
+           || write_tag_footer(fd, tag_header, tag_size) != 0){
+            return EDIT_FAILED;
+        }
+
+        // Same audio under a new modification time
+        if(hash_known && fstat(fd, &identity) == 0){
+            store_audio_hash(&identity, cached_hash);
+        }
+
+        journal_end(filename);
+        return EDIT_IN_PLACE;
+    }
+
+    AudioHash audio_hash;
+    unsigned long long payload_start = 0, payload_end = 0;
+    int hashing = hash_cache_enabled() && audio_payload_range(fd, &payload_start, &payload_end);
+    if(hashing){
+        init_audio_hash(&audio_hash, payload_end - payload_start);
+    }
+
+    // Case 2: The frames don't fit (or there is no tag), rebuild the file once with some room for later edits
+    char tmp_filename[FILENAME_MAX];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+    int tmp_fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(tmp_fd < 0){
+        perror("Failed to open file");
+        return EDIT_FAILED;
+    }
+
+    encode_syncsafe(frames_length + DEFAULT_TAG_PADDING, &tag_header[6]);
+    if(write_tag_vector(tmp_fd, tag_header, frames, frames_length, DEFAULT_TAG_PADDING) != 0){
+        close(tmp_fd);
+        remove(tmp_filename);
+        return EDIT_FAILED;
+    }
+
+    FILE *tmp_file = fdopen(tmp_fd, "wb");
     FILE *original_file = fopen(filename, "rb");
-    if(!original_file){
+    if(!tmp_file || !original_file){
         perror("Failed to open file");
-        return 1;
+        if(tmp_file){
+            fclose(tmp_file);
+        }
+        else{
+            close(tmp_fd);
+        }
+        if(original_file){
+            fclose(original_file);
+        }
+        remove(tmp_filename);
+        return EDIT_FAILED;
     }
 
-    // Create a temporary file to hold updated MP3 data
-    FILE *tmp_file = fopen("tmp.mp3", "wb");
-    if(!tmp_file){
+    // The audio goes after the new tag, skipping the old tag (if any)
+    fseek(tmp_file, 0, SEEK_END);
+    fseek(original_file, has_tag ? TAG_HEADER_SIZE + old_tag_size : 0, SEEK_SET);
+    int copied = copy_remaining_data(original_file, tmp_file, hashing ? &audio_hash : NULL, payload_start, payload_end);
+    fclose(original_file);
+
+    // The original is overwritten from the copy, so the copy must be complete (and, for the journal, on disk)
+    int synced = copied && fflush(tmp_file) == 0 && !ferror(tmp_file)
+              && (!checkpoint_enabled() || fsync(tmp_fd) == 0);
+    if(fclose(tmp_file) != 0 || !synced){
+        // A failed copy has already said why
+        if(copied){
+            perror("Failed to write file");
+        }
+        remove(tmp_filename);
+        return EDIT_FAILED;
+    }
+
+    // The original is only overwritten when the copied audio matches what was recorded for it
+    uint64_t copied_hash = hashing ? finish_audio_hash(&audio_hash) : 0;
+    if(hashing && hash_known && copied_hash != cached_hash){
+        fprintf(stderr, "Audio of %s doesn't match its recorded hash, file left unchanged\n", filename);
+        remove(tmp_filename);
+        return EDIT_FAILED;
+    }
+
+    if(!journal_rebuilt(filename, tmp_filename)){
+        remove(tmp_filename);
+        return EDIT_FAILED;
+    }
+
+    // The old footer was copied along with the audio, right after the new padding
+    if(copy_to_original_file(filename, tmp_filename) != 0
+       || write_tag_footer(fd, tag_header, frames_length + DEFAULT_TAG_PADDING) != 0){
+        return EDIT_FAILED;
+    }
+
+    if(hashing && stat(filename, &identity) == 0){
+        store_audio_hash(&identity, copied_hash);
+    }
+
+    journal_end(filename);
+    return EDIT_APPLIED;
+}
+
+int write_id3_tag(const char *filename, const TagData *data, const unsigned int *tag_size, const char *option) {
+    int fd = open(filename, O_RDWR);
+    if(fd < 0){
         perror("Failed to open file");
-        return 1;
+        return EDIT_FAILED;
     }
 
-    // Buffer to hold the 10-byte ID3 tag header
-    unsigned char tag_header[TAG_HEADER_SIZE] = {0};
-    // Copy the tag header from original to temporary file and keep a copy in tag_header
-    copy_tag_header(original_file, tmp_file, tag_header);
+    // Read the header and the whole tag in one go, frames are then copied from memory
+    unsigned char *tag = (unsigned char *)malloc(TAG_HEADER_SIZE + *tag_size);
+    if(!tag){
+        perror("Memory allocation failed\n");
+        close(fd);
+        return EDIT_FAILED;
+    }
 
-    unsigned int frames_written = copy_tag_frames(original_file, tmp_file, tag_size, option, data);
+    if(pread(fd, tag, TAG_HEADER_SIZE + *tag_size, 0) != (ssize_t)(TAG_HEADER_SIZE + *tag_size)){
+        display_error("Unexpected end of file or read error while reading the tag.");
+        free(tag);
+        close(fd);
+        return EDIT_FAILED;
+    }
+    throttle_read(TAG_HEADER_SIZE + *tag_size);
 
-    // Adjust padding or header size depending on edited frame size
-    if(frames_written < *tag_size){
-        // Case 1: New total frame size is smaller than original tag size after edit, keep padding the same size as original
-        unsigned int padding_size = *tag_size - frames_written;
+    // Frames are copied decoded: the new tag is written without unsynchronisation or extended header
+    normalize_tag_body(tag + TAG_HEADER_SIZE, *tag_size, tag[3], &tag[5]);
 
-        char *padding_buf = (char *)calloc(1, padding_size);
-        if(!padding_buf){
-            perror("Memory allocation failed\n");
-            return -1;
+    // The new frames are assembled in one buffer so that the final tag size is known before writing
+    TagBuffer frames;
+    init_tag_buffer(&frames);
+
+    int status = EDIT_FAILED;
+    if(reserve_tag_buffer(&frames, *tag_size + FRAME_HEADER_SIZE * TAG_FIELD_COUNT)
+       && copy_tag_frames(tag + TAG_HEADER_SIZE, tag_size, &frames, option, data, tag[3]) != (unsigned int)-1
+       && encode_frame_sizes(frames.data, frames.length, tag[3])){
+        status = store_tag(filename, fd, tag, frames.data, frames.length, 1, *tag_size);
+    }
+
+    if(close(fd) != 0 && status == EDIT_IN_PLACE){
+        status = EDIT_FAILED;
+    }
+
+    free_tag_buffer(&frames);
+    free(tag);
+
+    return status;
+}
+
+int apply_tag_edits(const char *filename, const TagData *edits, const char *option){
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return EDIT_FAILED;
+    }
+
+    unsigned char identifier[3];
+    if(fread(identifier, 3, 1, file) != 1 || memcmp(identifier, "ID3", 3) != 0){
+        fclose(file);
+        return EDIT_FAILED;
+    }
+
+    //Size of the ID3 tag (excluding the ID3 header, but includes extended header and padding)
+    unsigned int tag_size = 0;
+
+    HeaderData *header_data = read_id3_header(file, &tag_size);
+    TagData *data = header_data ? read_id3_text_frames(file, header_data, &tag_size) : NULL;
+    free_header_data(header_data);
+    fclose(file);
+    if (!data) {
+        return EDIT_FAILED;
+    }
+
+    // Only the fields whose value actually differs are rewritten
+    char changed_option[TAG_FIELD_COUNT + 2] = "-";
+    unsigned int changed_count = 0;
+
+    for(int i = 0; i < TAG_FIELD_COUNT; i++){
+        char letter = tag_fields[i].option;
+        if(!option_selects(option, letter)){
+            continue;
+        }
+
+        const char *new_value = *tag_field_value((TagData *)edits, letter);
+        const char *old_value = *tag_field_value(data, letter);
+        if(!new_value || (old_value && strcmp(old_value, new_value) == 0)){
+            continue;
+        }
+
+        if(!set_tag_field(data, letter, new_value)){
+            free_tag_data(data);
+            return EDIT_FAILED;
         }
+        changed_option[1 + changed_count++] = letter;
+    }
 
-        //Write the padding data to temp file
-        fwrite(padding_buf, padding_size, 1, tmp_file);
+    int status = EDIT_UNCHANGED;
+    if(changed_count){
+        status = write_id3_tag(filename, data, &tag_size, changed_option);
     }
-    else if (frames_written > *tag_size) {
-        // Case 2: New total frame size exceeds original tag size after edit, update header with new tag size
-        // In this case, no explicit padding is written because the new tag size exceeds the original tag size, which means there’s no extra room to pad, and the tag grows.
 
-        // Update the tag size in the header using synchsafe integer format
-        encode_syncsafe(frames_written, &tag_header[6]); // Encode into header bytes 6-9
-        // Rewind the temp file to the beginning to overwrite the old header with the updated size
-        rewind(tmp_file);
-        fwrite(tag_header, TAG_HEADER_SIZE, 1, tmp_file); 
+    free_tag_data(data);
+
+    return status;
+}
 
-        // Skip the whole header and frame section to the beginning of the audio part
-        fseek(original_file, FRAME_HEADER_SIZE + *tag_size, SEEK_SET);
+int write_serialized_tag(const char *filename, const unsigned char *version, const TagBuffer *frames){
+    int fd = open(filename, O_RDWR);
+    if(fd < 0){
+        return EDIT_FAILED;
     }
 
-    copy_remaining_data(original_file, tmp_file);
+    // Current header of the target, if it has an ID3v2 tag at all
+    unsigned char tag_header[TAG_HEADER_SIZE] = {0};
+    unsigned int old_tag_size = 0;
+    int has_tag = pread(fd, tag_header, TAG_HEADER_SIZE, 0) == TAG_HEADER_SIZE && memcmp(tag_header, "ID3", 3) == 0;
+    if(has_tag){
+        old_tag_size = decode_syncsafe(&tag_header[6]);
+    }
 
-    fclose(original_file);
-    fclose(tmp_file);
+    // A v2.4 footer of the target stays in front of the audio, it is kept up to date
+    int had_footer = has_tag && tag_header[3] == 4 && (tag_header[5] & TAG_FLAG_FOOTER);
+    int footer = had_footer && version[0] == 4;
+    if(had_footer && !footer){
+        // The new tag has no footer, the old one is replaced along with the tag
+        old_tag_size += TAG_HEADER_SIZE;
+    }
 
-    copy_to_original_file(filename, "tmp.mp3");
+    memcpy(tag_header, "ID3", 3);
+    tag_header[3] = version[0];
+    tag_header[4] = version[1];
+    // The new tag carries no extended header or other flagged features
+    tag_header[5] = footer ? TAG_FLAG_FOOTER : 0;
 
-    return 0;
+    int status = store_tag(filename, fd, tag_header, frames->data, frames->length, has_tag, old_tag_size);
+
+    if(close(fd) != 0 && status == EDIT_IN_PLACE){
+        status = EDIT_FAILED;
+    }
+
+    return status;
 }
 
 int edit_tag(const char *filename, const char *option, const char *value) {
@@ -224,44 +590,52 @@ int edit_tag(const char *filename, const char *option, const char *value) {
     //Size of the ID3 tag (excluding the ID3 header, but includes extended header and padding)
     unsigned int tag_size = 0;
 
-    char *option_string;
+    char *option_string = NULL;
     
-    read_id3_header(file, &tag_size);
-    TagData *data = read_id3_tag(file, &tag_size);
+    HeaderData *header_data = read_id3_header(file, &tag_size);
+    TagData *data = header_data ? read_id3_text_frames(file, header_data, &tag_size) : NULL;
+    free_header_data(header_data);
     if (!data) {
+        fclose(file);
         return 1;
     }
 
     if(strcmp(option, "-t") == 0){
-        strcpy(data->title, value);
+        set_tag_field(data, 't', value);
         option_string = "Title";
     }
     else if(strcmp(option, "-T") == 0){
-        strcpy(data->track, value);
+        set_tag_field(data, 'T', value);
         option_string = "Track";
     }
     else if(strcmp(option, "-a") == 0){
-        strcpy(data->artist, value);
+        set_tag_field(data, 'a', value);
         option_string = "Artist";
     }
     else if(strcmp(option, "-A") == 0){
-        strcpy(data->album, value);
+        set_tag_field(data, 'A', value);
         option_string = "Album";
     }
     else if(strcmp(option, "-y") == 0){
-        strcpy(data->year, value);
+        set_tag_field(data, 'y', value);
         option_string = "Year";
     }
     else if(strcmp(option, "-c") == 0){
-        strcpy(data->comment, value);
+        set_tag_field(data, 'c', value);
         option_string = "Comment";
     }
     else if(strcmp(option, "-g") == 0){
-        strcpy(data->genre, value);
+        set_tag_field(data, 'g', value);
         option_string = "Genre";
     }
     
-    write_id3_tag(filename, data, &tag_size, option);
+    fclose(file);
+
+    if (!option_string || write_id3_tag(filename, data, &tag_size, option) == EDIT_FAILED) {
+        free_tag_data(data);
+        return 1;
+    }
+    free_tag_data(data);
 
     printf("--------------- Select Edit Option ------------------------\n");
 
@@ -270,7 +644,5 @@ int edit_tag(const char *filename, const char *option, const char *value) {
 
     printf("------------- %s changed successfully ------------------\n", option_string);
 
-    fclose(file);
-
     return 0;
 }
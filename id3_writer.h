@@ -1,54 +1,80 @@
 #ifndef ID3_WRITER_H
 #define ID3_WRITER_H
 
+#include "id3_utils.h"
+#include "tag_builder.h"
+#include "audio_hash.h"
+
 /**
- * @brief Copies the ID3 tag header.
- * 
- * @param FilePointer1 Pointer to the original MP3 file structure.
- * @param FilePointer2 Pointer to the temporary file structure.
- * @param tagheader Stores the tag header data.
+ * @brief Outcome of applying a set of edits to one file.
  */
-void copy_tag_header(FILE *, FILE *, unsigned char *);
+#define EDIT_APPLIED 0   /**< Tag rewritten with the new values */
+#define EDIT_UNCHANGED 1 /**< All values already matched, nothing written */
+#define EDIT_FAILED 2    /**< File could not be read or written */
+#define EDIT_IN_PLACE 3  /**< Tag rewritten within its existing size, audio untouched */
 
 /**
- * @brief Copies the ID3 tag header.
+ * @brief Copies the ID3 tag frames into a tag buffer, replacing the edited ones.
  * 
- * @param FilePointer1 Pointer to the original MP3 file structure.
- * @param FilePointer2 Pointer to the temporary file structure.
+ * @param tagbody The ID3 tag as read from the file (without the 10 byte header).
  * @param tagsize Size of the ID3 tag (excluding the ID3 header, but includes extended header and padding).
- * @param option Frame ID edited.
+ * @param frames Tag buffer receiving the frames (without padding).
+ * @param option Edit option(s), e.g. "-t" or "-taA" to replace several frames in one pass.
  * @param data Pointer to the TagData structure containing the ID3 tags.
- * @return ID3 tag size after edit on success, -1 on failure.
+ * @param version ID3v2 major version of the tag, selects the frame IDs of the fields.
+ * @return Size of the frames after edit on success, -1 on failure.
  */
-unsigned int copy_tag_frames(FILE *, FILE *, const unsigned int *, const char *, const TagData *);
+unsigned int copy_tag_frames(const unsigned char *, const unsigned int *, TagBuffer *, const char *, const TagData *, unsigned char);
 
 /**
  * @brief Copies the remaining audio data.
  * 
  * @param FilePointer1 Pointer to the original MP3 file structure.
  * @param FilePointer2 Pointer to the temporary file structure.
+ * @param audiohash Hash fed with the copied audio payload, NULL to skip hashing.
+ * @param hash_start Offset in the original file where the audio payload starts.
+ * @param hash_end Offset in the original file just past the audio payload.
+ * @return SUCCESS on success, FAILURE on a read or write error.
  */
-void copy_remaining_data(FILE *, FILE *);
+int copy_remaining_data(FILE *, FILE *, AudioHash *, unsigned long long, unsigned long long);
 
 /**
  * @brief Copies the whole data from temporary file to original MP3 file.
  * 
  * @param FileName1 Filename of the original MP3 file.
  * @param FileName12 Filename of the temporary file.
+ * @return 0 on success, non-zero on failure.
  */
-void copy_to_original_file(const char *, const char *);
+int copy_to_original_file(const char *, const char *);
 
 /**
  * @brief Writes the ID3 tag to an MP3 file.
+ *
+ * The header, frames and padding are assembled in memory and written with a single
+ * pwritev. When the new frames fit in the current tag the audio is not touched,
+ * otherwise the file is rebuilt once with DEFAULT_TAG_PADDING bytes of padding.
  * 
  * @param filename The name of the MP3 file.
  * @param data Pointer to the TagData structure containing the ID3 tags.
  * @param tagsize Size of the ID3 tag (excluding the ID3 header, but includes extended header and padding).
- * @param option Frame ID edited.
- * @return 0 on success, non-zero on failure.
+ * @param option Edit option(s), e.g. "-t" or "-taA".
+ * @return EDIT_IN_PLACE or EDIT_APPLIED on success, EDIT_FAILED on failure.
  */
 int write_id3_tag(const char *, const TagData *, const unsigned int *, const char *);
 
+/**
+ * @brief Applies several field edits to one file in a single rewrite.
+ *
+ * Fields whose current value already matches are skipped, and the file is not
+ * touched at all when nothing differs.
+ * 
+ * @param filename The name of the MP3 file.
+ * @param edits TagData holding the new values of the selected fields.
+ * @param option Edit options selecting the fields, e.g. "-taA".
+ * @return EDIT_APPLIED, EDIT_UNCHANGED or EDIT_FAILED.
+ */
+int apply_tag_edits(const char *, const TagData *, const char *);
+
 /**
  * @brief Edit the ID3 tag.
  * 
@@ -60,4 +86,20 @@ int write_id3_tag(const char *, const TagData *, const unsigned int *, const cha
  */
 int edit_tag(const char *, const char *, const char *);
 
+/**
+ * @brief Replaces the whole ID3 tag of a file with already serialized frames.
+ *
+ * When the existing tag is large enough the header, frames and padding are written
+ * in place and the audio is left untouched. Otherwise the file is rebuilt once with
+ * the new tag followed by DEFAULT_TAG_PADDING bytes of padding. Files without an ID3v2
+ * tag get one prepended. A v2.4 footer of the old tag is kept when the new tag is v2.4
+ * too, otherwise it is replaced along with the old tag.
+ * 
+ * @param filename The name of the MP3 file.
+ * @param version Major and revision version bytes of the serialized frames.
+ * @param frames Serialized frames (no header, no padding).
+ * @return EDIT_IN_PLACE, EDIT_APPLIED (file rebuilt) or EDIT_FAILED.
+ */
+int write_serialized_tag(const char *, const unsigned char *, const TagBuffer *);
+
 #endif // ID3_WRITER_H
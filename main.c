@@ -2,6 +2,15 @@
 #include "id3_reader.h"
 #include "id3_writer.h"
 #include "error_handling.h"
+#include "batch_edit.h"
+#include "tag_clone.h"
+#include "batch_scan.h"
+#include "audio_hash.h"
+#include "watch.h"
+#include "report.h"
+#include "throttle.h"
+#include "checkpoint.h"
+#include "shard.h"
 
 /**
  * @brief Displays the help message for the MP3 Tag Reader application.
@@ -9,14 +18,313 @@
 void display_help() {
     printf("Usage: ./mp3tag [OPTION] filename.mp3\n");
     printf("       ./mp3tag -e [EDITOPTION] <value> filename\n");
+    printf("       ./mp3tag -b manifest [-j threads] [--checkpoint file [--resume]]\n");
+    printf("       ./mp3tag --clone reference.mp3 [-j threads] [--checkpoint file [--resume]] target.mp3...\n");
+    printf("       ./mp3tag --apply [EDITOPTION <value>]... [-j threads] [--checkpoint file [--resume]] target.mp3...\n");
+    printf("       ./mp3tag --scan [-j threads] [--order directory|inode|physical] [--hash|--dupes] [--checkpoint file [--resume]]\n");
+    printf("                       [--shard i/N] [--partial file] path...\n");
+    printf("       ./mp3tag --watch directory [--debounce ms] [--hash]\n");
+    printf("       ./mp3tag --report [-j threads] [--order directory|inode|physical] [--checkpoint file [--resume]]\n");
+    printf("                         [--shard i/N] [--partial file] path...\n");
+    printf("       ./mp3tag --merge [--report|--dupes] partial...\n");
     printf("Options:\n");
     printf("  -v               View song info\n");
     printf("  -h, --help       Display this help\n");
     printf("  -e               Edit tags\n");
+    printf("  -b               Bulk edit tags from a CSV (path,field,value) or JSONL manifest\n");
+    printf("  --clone          Copy the tag of a reference file to every target\n");
+    printf("  --apply          Replace the tag of every target with the given fields (none clears it)\n");
+    printf("  --scan           Print the tags of every MP3 file under the given paths, one line per file\n");
+    printf("  --order          Scan order; inode or physical keeps rotational disks reading sequentially\n");
+    printf("  --hash           Add the hash of the audio payload (tags excluded) to each scanned file\n");
+    printf("  --dupes          Print groups of files with identical audio instead of the tags\n");
+    printf("  --watch          Scan a directory, then stream changes: \"+<TAB>record\" or \"-<TAB>path\"\n");
+    printf("  --debounce       Quiet time in ms before a changed file is read again (default: %d)\n", WATCH_DEBOUNCE_MS);
+    printf("  --report         Print library statistics (per artist/genre/year, tag, padding and art sizes)\n");
+    printf("  --shard          Scan only shard i of N (1 <= i <= N <= %d), chosen by a hash of each path as given\n", SCAN_SHARD_MAX);
+    printf("  --partial        Write the records and statistics of the scan to a file for --merge instead of printing\n");
+    printf("  --merge          Combine partial results into one scan listing, or a report (--report) or duplicate groups (--dupes)\n");
+    printf("  -j               Number of worker threads for bulk modes (default: one per CPU)\n");
+    printf("  --checkpoint     Record completed files and journal in-flight edits of a bulk mode in a file\n");
+    printf("  --resume         Continue the run recorded in the checkpoint: finished files are skipped,\n");
+    printf("                   interrupted edits are completed or rolled back\n");
+    printf("Environment:\n");
+    printf("  MP3TAG_HASH_CACHE  File caching audio hashes per file identity; edits keep it current and\n");
+    printf("                     refuse to replace a file whose copied audio doesn't match its cached hash\n");
+    printf("  MP3TAG_THROTTLE    Limits and I/O priority of bulk modes, e.g. \"read=20M write=10M files=100 ioprio=idle\"\n");
+    printf("                     (ioprio: idle, be[:0-7] or none)\n");
+    printf("  MP3TAG_THROTTLE_FILE  Control file with the same settings, re-read when it changes or on SIGUSR1\n");
     printf("Edit Tag Options:\n");
     printf("      -t           Modifies Title tag\n      -T           Modifies Track tag\n      -a           Modifies Artist tag\n      -A           Modifies Album tag\n      -y           Modifies Year tag\n      -c           Modifies Comment tag\n      -g           Modifies Genre tag\n");
 }
 
+/**
+ * @brief Consumes a --checkpoint file or --resume option of a bulk mode.
+ * @return Number of arguments consumed, 0 if the argument is neither.
+ */
+static int parse_checkpoint_option(int argc, char *argv[], int i, const char **checkpoint_path, int *resume){
+    if(strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc){
+        *checkpoint_path = argv[i + 1];
+        return 2;
+    }
+    if(strcmp(argv[i], "--resume") == 0){
+        *resume = 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Opens the checkpoint given on the command line, if any; it is closed at exit.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int start_checkpoint(const char *checkpoint_path, int resume){
+    if(!checkpoint_path){
+        if(resume){
+            display_error("--resume needs --checkpoint file.");
+            return FAILURE;
+        }
+        return SUCCESS;
+    }
+
+    if(!open_checkpoint(checkpoint_path, resume)){
+        return FAILURE;
+    }
+    atexit(close_checkpoint);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Handles -b: parses its options and applies the manifest.
+ * 
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return 0 on success, non-zero on failure.
+ */
+static int run_batch_edit_command(int argc, char *argv[]){
+    unsigned int threads = 0;
+    const char *checkpoint_path = NULL;
+    int resume = 0;
+
+    for(int i = 3; i < argc; ){
+        int consumed = parse_checkpoint_option(argc, argv, i, &checkpoint_path, &resume);
+        if(consumed){
+            i += consumed;
+        }
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc){
+            threads = (unsigned int)atoi(argv[i + 1]);
+            i += 2;
+        }
+        else{
+            display_help();
+            return 1;
+        }
+    }
+
+    if(!start_checkpoint(checkpoint_path, resume)){
+        return 1;
+    }
+
+    return run_batch_edit(argv[2], threads);
+}
+
+/**
+ * @brief Handles --clone and --apply: serializes the tag once and writes it to every target.
+ * 
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return 0 on success, non-zero on failure.
+ */
+static int run_clone_command(int argc, char *argv[]){
+    int clone = strcmp(argv[1], "--clone") == 0;
+    unsigned char version[2] = {3, 0};
+    unsigned int threads = 0;
+    const char *checkpoint_path = NULL;
+    int resume = 0;
+    TagBuffer frames;
+    init_tag_buffer(&frames);
+
+    TagData *data = create_tag_data();
+    if(!data){
+        perror("Memory allocation failed");
+        return 1;
+    }
+
+    int i = 2;
+    if(clone && !read_reference_frames(argv[i++], version, &frames)){
+        free_tag_data(data);
+        return 1;
+    }
+
+    // Field options (--apply only), thread count and checkpoint come before the targets
+    while(i + 1 < argc && argv[i][0] == '-'){
+        int consumed = parse_checkpoint_option(argc, argv, i, &checkpoint_path, &resume);
+        if(consumed){
+            i += consumed;
+            continue;
+        }
+
+        if(argv[i][1] == '\0' || argv[i][2] != '\0'){
+            break;
+        }
+        if(argv[i][1] == 'j'){
+            threads = (unsigned int)atoi(argv[i + 1]);
+        }
+        else if(clone || !set_tag_field(data, argv[i][1], argv[i + 1])){
+            display_help();
+            free_tag_data(data);
+            free_tag_buffer(&frames);
+            return 1;
+        }
+        i += 2;
+    }
+
+    int status = 1;
+    if(i >= argc){
+        display_help();
+    }
+    else if(start_checkpoint(checkpoint_path, resume) && (clone || serialize_tag_data(&frames, data, version[0]))){
+        status = run_tag_clone(version, &frames, &argv[i], argc - i, threads);
+    }
+
+    free_tag_data(data);
+    free_tag_buffer(&frames);
+
+    return status;
+}
+
+/**
+ * @brief Handles --scan and --report: parses their options and scans the given paths.
+ * 
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return 0 on success, non-zero on failure.
+ */
+static int run_scan_command(int argc, char *argv[]){
+    ScanOptions options = {SCAN_ORDER_DIRECTORY, 0, 0, 0, 0, 0};
+    const char *checkpoint_path = NULL;
+    const char *partial_path = NULL;
+    int resume = 0;
+    int i = 2;
+
+    while(i + 1 < argc){
+        int consumed = parse_checkpoint_option(argc, argv, i, &checkpoint_path, &resume);
+        if(consumed){
+            i += consumed;
+        }
+        else if(strcmp(argv[i], "-j") == 0){
+            options.thread_count = (unsigned int)atoi(argv[i + 1]);
+            i += 2;
+        }
+        else if(strcmp(argv[i], "--order") == 0){
+            if((options.order = parse_scan_order(argv[i + 1])) < 0){
+                display_help();
+                return 1;
+            }
+            i += 2;
+        }
+        else if(strcmp(argv[i], "--shard") == 0){
+            if(!parse_scan_shard(argv[i + 1], &options.shard_index, &options.shard_count)){
+                display_help();
+                return 1;
+            }
+            i += 2;
+        }
+        else if(strcmp(argv[i], "--partial") == 0){
+            partial_path = argv[i + 1];
+            i += 2;
+        }
+        else if(strcmp(argv[i], "--hash") == 0){
+            options.audio_hash = 1;
+            i++;
+        }
+        else if(strcmp(argv[i], "--dupes") == 0){
+            options.audio_hash = options.duplicates_only = 1;
+            i++;
+        }
+        else{
+            break;
+        }
+    }
+
+    if(i >= argc){
+        display_help();
+        return 1;
+    }
+
+    if(!start_checkpoint(checkpoint_path, resume)){
+        return 1;
+    }
+
+    // Sharded runs of several hosts are combined later with --merge
+    if(partial_path){
+        return run_partial_scan(&argv[i], argc - i, &options, partial_path);
+    }
+
+    if(strcmp(argv[1], "--report") == 0){
+        return run_report(&argv[i], argc - i, &options);
+    }
+
+    return run_batch_scan(&argv[i], argc - i, &options);
+}
+
+/**
+ * @brief Handles --merge: combines partial results into one listing or report.
+ * 
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return 0 on success, non-zero on failure.
+ */
+static int run_merge_command(int argc, char *argv[]){
+    int mode = MERGE_INDEX;
+    int i = 2;
+
+    if(strcmp(argv[i], "--report") == 0){
+        mode = MERGE_REPORT;
+        i++;
+    }
+    else if(strcmp(argv[i], "--dupes") == 0){
+        mode = MERGE_DUPES;
+        i++;
+    }
+
+    if(i >= argc){
+        display_help();
+        return 1;
+    }
+
+    return run_merge(&argv[i], argc - i, mode);
+}
+
+/**
+ * @brief Handles --watch: parses its options and follows the directory.
+ * 
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return 0 on success, non-zero on failure.
+ */
+static int run_watch_command(int argc, char *argv[]){
+    unsigned int debounce_ms = WATCH_DEBOUNCE_MS;
+    int audio_hash = 0;
+
+    for(int i = 3; i < argc; i++){
+        if(strcmp(argv[i], "--debounce") == 0 && i + 1 < argc){
+            debounce_ms = (unsigned int)atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--hash") == 0){
+            audio_hash = 1;
+        }
+        else{
+            display_help();
+            return 1;
+        }
+    }
+
+    return run_watch(argv[2], debounce_ms, audio_hash);
+}
+
 /**
  * @brief Main function to handle command-line arguments and execute appropriate actions.
  * 
@@ -24,6 +332,16 @@ void display_help() {
  * @param argv Argument vector.
  */
 int main(int argc, char *argv[]){
+#ifdef ALLOC_TRACE
+    start_alloc_trace();
+#endif
+    open_hash_cache(getenv("MP3TAG_HASH_CACHE"));
+    atexit(close_hash_cache);
+
+    if(!open_throttle(getenv("MP3TAG_THROTTLE"), getenv("MP3TAG_THROTTLE_FILE"))){
+        return 1;
+    }
+
     if (argc <= 2) {
         display_help();
     }
@@ -58,6 +376,35 @@ int main(int argc, char *argv[]){
             }
             printf("Tag edited successfully.\n");
         } 
+        else if (strcmp(argv[1], "-b") == 0) {
+            if (run_batch_edit_command(argc, argv) != 0) {
+                display_error("Some files could not be edited.");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[1], "--clone") == 0 || strcmp(argv[1], "--apply") == 0) {
+            if (run_clone_command(argc, argv) != 0) {
+                display_error("Some files could not be written.");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[1], "--scan") == 0 || strcmp(argv[1], "--report") == 0) {
+            if (run_scan_command(argc, argv) != 0) {
+                display_error("Some files could not be scanned.");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[1], "--merge") == 0) {
+            if (run_merge_command(argc, argv) != 0) {
+                display_error("Some partial results could not be merged or had failed files.");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[1], "--watch") == 0) {
+            if (run_watch_command(argc, argv) != 0) {
+                return 1;
+            }
+        }
         else {
             display_help();
         }
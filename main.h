@@ -5,6 +5,10 @@
 #include <string.h>
 #include <stdlib.h>
 
+#ifdef ALLOC_TRACE
+#include "alloc_trace.h"
+#endif
+
 /**
  * @brief Displays the help message for the MP3 Tag Reader application.
  */
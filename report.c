@@ -0,0 +1,254 @@
+/**
+ * @file report.c
+ * @brief Library wide statistics computed from a parallel scan.
+ */
+#include "report.h"
+#include "error_handling.h"
+
+/**
+ * @brief Number of tracks sharing one value of a column.
+ */
+typedef struct {
+    const char *name;  /**< Value, "(none)" when missing */
+    unsigned int key;  /**< String ID or year */
+    size_t count;      /**< Number of tracks */
+} ValueCount;
+
+/**
+ * @brief Returns the histogram bucket of a size.
+ */
+static int size_bucket(unsigned long long size){
+    int bucket = 0;
+    while(size && bucket < REPORT_HISTOGRAM_BUCKETS - 1){
+        size >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/**
+ * @brief Formats a byte count with a binary unit.
+ */
+static void format_size(unsigned long long size, char *text, size_t text_size){
+    const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double value = size;
+    int unit = 0;
+
+    while(value >= 1024 && unit < 4){
+        value /= 1024;
+        unit++;
+    }
+
+    if(unit == 0){
+        snprintf(text, text_size, "%llu B", size);
+    }
+    else{
+        snprintf(text, text_size, "%.1f %s", value, units[unit]);
+    }
+}
+
+/**
+ * @brief Prints the non-empty buckets of a size histogram.
+ */
+static void print_histogram(FILE *out, const char *title, const size_t *histogram){
+    fprintf(out, "%s:\n", title);
+
+    for(int bucket = 0; bucket < REPORT_HISTOGRAM_BUCKETS; bucket++){
+        if(!histogram[bucket]){
+            continue;
+        }
+
+        if(bucket == 0){
+            fprintf(out, "  %-24s %zu\n", "0 B", histogram[bucket]);
+            continue;
+        }
+
+        char low[32], high[32], range[72];
+        format_size(1ULL << (bucket - 1), low, sizeof(low));
+        format_size(1ULL << bucket, high, sizeof(high));
+        snprintf(range, sizeof(range), "[%s, %s)", low, high);
+        fprintf(out, "  %-24s %zu\n", range, histogram[bucket]);
+    }
+}
+
+/**
+ * @brief Orders values by decreasing count, then by name.
+ */
+static int compare_by_count(const void *a, const void *b){
+    const ValueCount *first = (const ValueCount *)a;
+    const ValueCount *second = (const ValueCount *)b;
+
+    if(first->count != second->count){
+        return first->count < second->count ? 1 : -1;
+    }
+
+    return strcmp(first->name, second->name);
+}
+
+/**
+ * @brief Orders values by key.
+ */
+static int compare_by_key(const void *a, const void *b){
+    const ValueCount *first = (const ValueCount *)a;
+    const ValueCount *second = (const ValueCount *)b;
+
+    return (first->key > second->key) - (first->key < second->key);
+}
+
+/**
+ * @brief Prints the values of a count array sorted, skipping values no track has.
+ */
+static void print_counts(FILE *out, const char *title, ValueCount *values, size_t count, int by_key){
+    size_t used = 0;
+    for(size_t i = 0; i < count; i++){
+        if(values[i].count){
+            values[used++] = values[i];
+        }
+    }
+
+    qsort(values, used, sizeof(ValueCount), by_key ? compare_by_key : compare_by_count);
+
+    fprintf(out, "%s (%zu):\n", title, used);
+    for(size_t i = 0; i < used; i++){
+        fprintf(out, "  %-40s %zu\n", values[i].name, values[i].count);
+    }
+}
+
+/**
+ * @brief Counts the tracks per value of a string column and prints them.
+ */
+static void print_string_counts(FILE *out, const char *title, const TagTable *table, const uint32_t *column){
+    size_t count = table->strings.count ? table->strings.count : 1;
+    ValueCount *values = (ValueCount *)calloc(count, sizeof(ValueCount));
+    if(!values){
+        perror("Memory allocation failed");
+        return;
+    }
+
+    // Only the ID column is walked, the strings are looked at once per distinct value
+    for(size_t row = 0; row < table->count; row++){
+        if(table->flags[row] & TAG_ROW_TAGGED){
+            values[column[row]].count++;
+        }
+    }
+    for(size_t id = 0; id < count; id++){
+        const char *name = pool_string(&table->strings, (uint32_t)id);
+        values[id].name = name ? name : "(none)";
+        values[id].key = (unsigned int)id;
+    }
+
+    print_counts(out, title, values, count, 0);
+    free(values);
+}
+
+/**
+ * @brief Counts the tracks per year and prints them in year order.
+ */
+static void print_year_counts(FILE *out, const TagTable *table){
+    ValueCount *values = (ValueCount *)calloc(0x10000, sizeof(ValueCount));
+    char *names = (char *)calloc(0x10000, 8);
+    if(!values || !names){
+        perror("Memory allocation failed");
+        free(values);
+        free(names);
+        return;
+    }
+
+    for(size_t row = 0; row < table->count; row++){
+        if(table->flags[row] & TAG_ROW_TAGGED){
+            values[table->year[row]].count++;
+        }
+    }
+    for(unsigned int year = 0; year < 0x10000; year++){
+        if(values[year].count){
+            snprintf(names + year * 8, 8, "%u", year);
+            values[year].name = year ? names + year * 8 : "(none)";
+            values[year].key = year;
+        }
+    }
+
+    print_counts(out, "Tracks per year", values, 0x10000, 1);
+    free(values);
+    free(names);
+}
+
+/**
+ * @brief Prints library statistics computed by scanning the columns of a tag table.
+ */
+void print_report(FILE *out, const TagTable *table, size_t failed){
+    size_t tagged = 0, art_files = 0, versions[3] = {0, 0, 0};
+    unsigned long long tag_bytes = 0, padding_bytes = 0, art_bytes = 0;
+    size_t padding_histogram[REPORT_HISTOGRAM_BUCKETS] = {0};
+    size_t art_histogram[REPORT_HISTOGRAM_BUCKETS] = {0};
+
+    for(size_t row = 0; row < table->count; row++){
+        if(!(table->flags[row] & TAG_ROW_TAGGED)){
+            continue;
+        }
+
+        tagged++;
+        if(table->version[row] >= 2 && table->version[row] <= 4){
+            versions[table->version[row] - 2]++;
+        }
+
+        tag_bytes += table->tag_size[row];
+        padding_bytes += table->padding[row];
+        padding_histogram[size_bucket(table->padding[row])]++;
+
+        if(table->art_size[row]){
+            art_files++;
+            art_bytes += table->art_size[row];
+            art_histogram[size_bucket(table->art_size[row])]++;
+        }
+    }
+
+    char total[32], average[32], padding[32], art[32];
+    format_size(tag_bytes, total, sizeof(total));
+    format_size(tagged ? tag_bytes / tagged : 0, average, sizeof(average));
+    format_size(padding_bytes, padding, sizeof(padding));
+    format_size(art_bytes, art, sizeof(art));
+
+    fprintf(out, "----------------------------------------------------\n");
+    fprintf(out, "                 MP3 Library Report\n");
+    fprintf(out, "----------------------------------------------------\n");
+    fprintf(out, "Files\t\t:\t%zu (%zu tagged, %zu failed)\n", table->count + failed, tagged, failed);
+    fprintf(out, "Versions\t:\tID3v2.2 %zu, ID3v2.3 %zu, ID3v2.4 %zu, none %zu\n", versions[0], versions[1], versions[2], table->count - tagged);
+    fprintf(out, "Tag size\t:\t%s total, %s average\n", total, average);
+    fprintf(out, "Padding\t\t:\t%s (%.1f%% of tag bytes)\n", padding, tag_bytes ? 100.0 * padding_bytes / tag_bytes : 0.0);
+    fprintf(out, "Album art\t:\t%s in %zu files\n", art, art_files);
+    fprintf(out, "----------------------------------------------------\n");
+
+    print_histogram(out, "Padding size histogram", padding_histogram);
+    print_histogram(out, "Album art size histogram", art_histogram);
+    fprintf(out, "----------------------------------------------------\n");
+
+    print_string_counts(out, "Tracks per artist", table, table->artist);
+    print_string_counts(out, "Tracks per genre", table, table->genre);
+    print_year_counts(out, table);
+}
+
+/**
+ * @brief Scans every MP3 file under the given paths in parallel and prints the library report.
+ * @return 0 if every file could be read, non-zero otherwise.
+ */
+int run_report(char **paths, int path_count, const ScanOptions *options){
+    ScanList list = {NULL, 0, 0};
+    if(!prepare_scan_list(paths, path_count, options, &list)){
+        return 1;
+    }
+
+    TagTable table;
+    size_t failed = 0;
+    init_tag_table(&table);
+
+    int status = scan_into_table(&list, options, &table, &failed);
+    if(status){
+        print_report(stdout, &table, failed);
+    }
+
+    free_tag_table(&table);
+    free_scan_list(&list);
+
+    return !status || failed ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "main.h"
+#include "batch_scan.h"
+#include "tag_table.h"
+
+// Power of two size buckets: 0 bytes, then [2^(k-1), 2^k) for k = 1..32
+#define REPORT_HISTOGRAM_BUCKETS 33
+
+/**
+ * @brief Prints library statistics computed by scanning the columns of a tag table.
+ *
+ * @param out Output stream.
+ * @param table Scanned files.
+ * @param failed Number of files that couldn't be read.
+ */
+void print_report(FILE *, const TagTable *, size_t);
+
+/**
+ * @brief Scans every MP3 file under the given paths in parallel and prints the library report.
+ *
+ * @param paths Files and directories.
+ * @param path_count Number of paths.
+ * @param options Scan options (order, threads).
+ * @return 0 if every file could be read, non-zero otherwise.
+ */
+int run_report(char **, int, const ScanOptions *);
+
+#endif // REPORT_H
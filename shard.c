@@ -0,0 +1,228 @@
+/**
+ * @file shard.c
+ * @brief Partial results of sharded scans and their merge.
+ */
+#include "shard.h"
+#include "tag_table.h"
+#include "report.h"
+#include "error_handling.h"
+
+/**
+ * @brief Writes the header, the paths and the table of a partial result.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int write_partial(FILE *file, const PartialHeader *header, const ScanList *list, const TagTable *table){
+    uint32_t byte_order = PARTIAL_BYTE_ORDER;
+
+    if(fwrite(PARTIAL_MAGIC, 1, 8, file) != 8 || fwrite(&byte_order, sizeof(byte_order), 1, file) != 1
+       || fwrite(header, sizeof(PartialHeader), 1, file) != 1){
+        return FAILURE;
+    }
+
+    for(size_t i = 0; i < list->count; i++){
+        uint32_t length = (uint32_t)strlen(list->files[i].path);
+        if(fwrite(&length, sizeof(length), 1, file) != 1 || fwrite(list->files[i].path, 1, length, file) != length){
+            return FAILURE;
+        }
+    }
+
+    return write_tag_table(file, table);
+}
+
+/**
+ * @brief Scans the files of the selected shard and writes a partial result file instead of printing.
+ * @return 0 if every file could be read and the result written, non-zero otherwise.
+ */
+int run_partial_scan(char **paths, int path_count, const ScanOptions *options, const char *output){
+    ScanList list = {NULL, 0, 0};
+    if(!prepare_scan_list(paths, path_count, options, &list)){
+        return 1;
+    }
+
+    TagTable table;
+    size_t failed = 0;
+    init_tag_table(&table);
+
+    int status = scan_into_table(&list, options, &table, &failed);
+    if(status){
+        // Cleared first so the padding of the header is written as zeros
+        PartialHeader header;
+        memset(&header, 0, sizeof(header));
+        header.shard_index = options->shard_index;
+        header.shard_count = options->shard_count;
+        header.audio_hash = options->audio_hash != 0;
+        header.file_count = list.count;
+        header.failed = failed;
+
+        // Written aside and renamed, a merge never sees half a partial
+        char tmp_path[FILENAME_MAX];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", output);
+
+        FILE *file = fopen(tmp_path, "wb");
+        if(!file){
+            perror("Failed to open partial result");
+            status = FAILURE;
+        }
+        else{
+            status = write_partial(file, &header, &list, &table);
+            if(fclose(file) != 0 || !status || rename(tmp_path, output) != 0){
+                perror("Failed to write partial result");
+                remove(tmp_path);
+                status = FAILURE;
+            }
+        }
+    }
+
+    if(status && options->shard_count){
+        printf("Shard %u/%u: %zu files, %zu failed, written to %s\n", options->shard_index, options->shard_count, list.count, failed, output);
+    }
+    else if(status){
+        printf("Partial result: %zu files, %zu failed, written to %s\n", list.count, failed, output);
+    }
+
+    free_tag_table(&table);
+    free_scan_list(&list);
+
+    return !status || failed ? 1 : 0;
+}
+
+/**
+ * @brief Reads a partial result, appending its paths to the list and its rows to the table.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int read_partial(const char *path, PartialHeader *header, ScanList *list, TagTable *table){
+    FILE *file = fopen(path, "rb");
+    if(!file){
+        perror("Failed to open partial result");
+        return FAILURE;
+    }
+
+    char magic[8];
+    uint32_t byte_order;
+    if(fread(magic, 1, 8, file) != 8 || memcmp(magic, PARTIAL_MAGIC, 8) != 0
+       || fread(&byte_order, sizeof(byte_order), 1, file) != 1 || byte_order != PARTIAL_BYTE_ORDER
+       || fread(header, sizeof(PartialHeader), 1, file) != 1){
+        fprintf(stderr, "%s is not a partial result of this architecture\n", path);
+        fclose(file);
+        return FAILURE;
+    }
+    if(header->shard_count > SCAN_SHARD_MAX
+       || (header->shard_count ? header->shard_index < 1 || header->shard_index > header->shard_count : header->shard_index != 0)){
+        fprintf(stderr, "%s is truncated or corrupt\n", path);
+        fclose(file);
+        return FAILURE;
+    }
+
+    // Rows of this partial refer to its own files, they follow those of the previous partials
+    size_t file_offset = list->count;
+    int status = SUCCESS;
+    char file_path[FILENAME_MAX];
+
+    for(uint64_t i = 0; i < header->file_count && status; i++){
+        uint32_t length;
+        status = fread(&length, sizeof(length), 1, file) == 1 && length < sizeof(file_path)
+              && fread(file_path, 1, length, file) == length;
+        if(status){
+            file_path[length] = '\0';
+            status = add_scan_file(list, file_path, 0);
+        }
+    }
+
+    TagTable part;
+    init_tag_table(&part);
+    if(status){
+        status = read_tag_table(file, &part);
+        for(size_t row = 0; status && row < part.count; row++){
+            status = part.file[row] < header->file_count;
+        }
+        if(!status){
+            fprintf(stderr, "%s is truncated or corrupt\n", path);
+        }
+    }
+
+    if(status){
+        status = merge_tag_table(table, &part, file_offset);
+    }
+
+    free_tag_table(&part);
+    fclose(file);
+
+    return status;
+}
+
+/**
+ * @brief Combines partial result files into one index, report or duplicate listing.
+ * @return 0 if the partials could be merged and no file failed, non-zero otherwise.
+ */
+int run_merge(char **partials, int count, int mode){
+    ScanList list = {NULL, 0, 0};
+    TagTable table;
+    init_tag_table(&table);
+
+    size_t failed = 0;
+    uint32_t shard_count = 0;
+    int audio_hash = 0;
+    char *seen = NULL;
+    int status = SUCCESS;
+
+    for(int i = 0; i < count && status; i++){
+        PartialHeader header;
+        if(!read_partial(partials[i], &header, &list, &table)){
+            status = FAILURE;
+            break;
+        }
+
+        failed += header.failed;
+
+        if(i == 0){
+            shard_count = header.shard_count;
+            audio_hash = header.audio_hash != 0;
+            seen = (char *)calloc((size_t)shard_count + 1, sizeof(char));
+            if(!seen){
+                perror("Memory allocation failed");
+                status = FAILURE;
+            }
+        }
+        else if(header.shard_count != shard_count){
+            fprintf(stderr, "%s comes from a split into %u shards, not %u\n", partials[i], header.shard_count, shard_count);
+            status = FAILURE;
+        }
+        else if((header.audio_hash != 0) != audio_hash){
+            // A merged index has the hash column for every file or for none
+            fprintf(stderr, "%s was scanned %s --hash, unlike %s\n", partials[i], audio_hash ? "without" : "with", partials[0]);
+            status = FAILURE;
+        }
+
+        // Unsharded partials (whole libraries) can be combined freely
+        if(status && shard_count && seen[header.shard_index]++){
+            fprintf(stderr, "Shard %u/%u is given twice\n", header.shard_index, shard_count);
+            status = FAILURE;
+        }
+    }
+
+    if(status){
+        for(uint32_t shard = 1; shard <= shard_count; shard++){
+            if(!seen[shard]){
+                fprintf(stderr, "Warning: shard %u/%u is missing\n", shard, shard_count);
+            }
+        }
+
+        switch(mode){
+            case MERGE_REPORT:
+                print_report(stdout, &table, failed);
+                break;
+            case MERGE_DUPES:
+                print_duplicates(&list, &table);
+                break;
+            default:
+                print_tag_table(&list, &table, audio_hash);
+                break;
+        }
+    }
+
+    free(seen);
+    free_tag_table(&table);
+    free_scan_list(&list);
+
+    return !status || failed ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "main.h"
+#include "batch_scan.h"
+
+#define PARTIAL_MAGIC "MP3TAGP2"       /**< First bytes of a partial result file */
+#define PARTIAL_BYTE_ORDER 0x01020304u /**< Written in host order, tells whether a partial can be read here */
+
+#define MERGE_INDEX 0  /**< Merged output: one record per file, as --scan prints them */
+#define MERGE_REPORT 1 /**< Merged output: library statistics, as --report prints them */
+#define MERGE_DUPES 2  /**< Merged output: groups of identical audio, as --dupes prints them */
+
+/**
+ * @brief Summary of a partial result file.
+ */
+typedef struct {
+    uint32_t shard_index;   /**< Shard scanned, 1 to shard_count (0 when unsharded) */
+    uint32_t shard_count;   /**< Number of shards (0 when unsharded) */
+    uint32_t audio_hash;    /**< Whether the audio hashes were computed */
+    uint64_t file_count;    /**< Files of the shard */
+    uint64_t failed;        /**< Files that couldn't be read */
+} PartialHeader;
+
+/**
+ * @brief Scans the files of the selected shard and writes a partial result file instead of printing.
+ *
+ * The file holds the shard statistics (PartialHeader), the paths of its files and its tag
+ * table (strings and columns), which --merge appends to the others without parsing any record.
+ * It is replaced atomically once complete.
+ *
+ * @param paths Files and directories.
+ * @param path_count Number of paths.
+ * @param options Scan options (shard, order, threads, audio hash).
+ * @param output Partial result file.
+ * @return 0 if every file could be read and the result written, non-zero otherwise.
+ */
+int run_partial_scan(char **, int, const ScanOptions *, const char *);
+
+/**
+ * @brief Combines partial result files into one index, report or duplicate listing.
+ *
+ * Files are listed shard after shard, in the order the partials are given. Partials must
+ * come from the same split; a shard given twice is an error, a missing one a warning.
+ *
+ * @param partials Partial result files.
+ * @param count Number of partial result files.
+ * @param mode MERGE_INDEX, MERGE_REPORT or MERGE_DUPES.
+ * @return 0 if the partials could be merged and no file failed, non-zero otherwise.
+ */
+int run_merge(char **, int, int);
+
+#endif // SHARD_H
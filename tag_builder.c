@@ -0,0 +1,122 @@
+/**
+ * @file tag_builder.c
+ * @brief In-memory serialization of ID3 frames.
+ */
+#include "tag_builder.h"
+#include "error_handling.h"
+
+/**
+ * @brief Initializes an empty tag buffer.
+ */
+void init_tag_buffer(TagBuffer *buffer){
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+/**
+ * @brief Frees the memory held by a tag buffer and leaves it empty.
+ */
+void free_tag_buffer(TagBuffer *buffer){
+    free(buffer->data);
+    init_tag_buffer(buffer);
+}
+
+/**
+ * @brief Makes sure the tag buffer can hold at least the given number of bytes without growing.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int reserve_tag_buffer(TagBuffer *buffer, size_t capacity){
+    if(capacity <= buffer->capacity){
+        return SUCCESS;
+    }
+
+    unsigned char *grown = (unsigned char *)realloc(buffer->data, capacity);
+    if(!grown){
+        perror("Memory allocation failed");
+        return FAILURE;
+    }
+    buffer->data = grown;
+    buffer->capacity = capacity;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Appends raw bytes to the tag buffer.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int append_tag_bytes(TagBuffer *buffer, const void *bytes, size_t count){
+    if(buffer->length + count > buffer->capacity){
+        size_t new_capacity = buffer->capacity ? buffer->capacity : 256;
+        while(new_capacity < buffer->length + count){
+            new_capacity *= 2;
+        }
+
+        if(!reserve_tag_buffer(buffer, new_capacity)){
+            return FAILURE;
+        }
+    }
+
+    memcpy(buffer->data + buffer->length, bytes, count);
+    buffer->length += count;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Appends a text frame (header, encoding byte and content) to the tag buffer.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int append_text_frame(TagBuffer *buffer, const char *frame_id, unsigned char encoding, const char *text){
+    unsigned char frame_header[FRAME_HEADER_SIZE] = {0};
+    size_t text_length = strlen(text);
+    // 1 added to account for the text encoding byte at the start of the frame content
+    unsigned int frame_size = text_length + 1;
+
+    memcpy(frame_header, frame_id, 4);
+    // Frame size is big-endian (as per ID3v2.3 spec)
+    for (int i = 0; i < 4; i++) {
+        frame_header[i + 4] = (frame_size >> (24 - (8 * i))) & 0xFF;
+    }
+
+    return append_tag_bytes(buffer, frame_header, FRAME_HEADER_SIZE)
+        && append_tag_bytes(buffer, &encoding, 1)
+        && append_tag_bytes(buffer, text, text_length);
+}
+
+/**
+ * @brief Serializes the set fields of a TagData structure as text frames.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int serialize_tag_data(TagBuffer *buffer, const TagData *data, unsigned char version){
+    for(int i = 0; i < TAG_FIELD_COUNT; i++){
+        const char *value = *tag_field_value((TagData *)data, tag_fields[i].option);
+        if(value && !append_text_frame(buffer, tag_field_frame_id(&tag_fields[i], version), 0, value)){
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Returns the length of the frame section of a tag body, i.e. where padding starts.
+ * @return Number of bytes taken by the frames.
+ */
+size_t frames_length(const unsigned char *body, size_t tag_size){
+    size_t position = 0;
+
+    // Same stopping rules as the reader: padding starts with a zero byte, and a frame must fit in the tag
+    while(position + FRAME_HEADER_SIZE <= tag_size && body[position] != 0){
+        const unsigned char *frame_header = body + position;
+        size_t frame_size = ((size_t)frame_header[4] << 24) | (frame_header[5] << 16) | (frame_header[6] << 8) | frame_header[7];
+
+        if(frame_size > tag_size - position - FRAME_HEADER_SIZE){
+            break;
+        }
+        position += FRAME_HEADER_SIZE + frame_size;
+    }
+
+    return position;
+}
@@ -0,0 +1,68 @@
+#ifndef TAG_BUILDER_H
+#define TAG_BUILDER_H
+
+#include "main.h"
+#include "id3_utils.h"
+
+/**
+ * @brief Growable in-memory buffer holding serialized ID3 frames.
+ */
+typedef struct {
+    unsigned char *data; /**< Serialized bytes */
+    size_t length;       /**< Number of bytes used */
+    size_t capacity;     /**< Number of bytes allocated */
+} TagBuffer;
+
+/**
+ * @brief Initializes an empty tag buffer.
+ */
+void init_tag_buffer(TagBuffer *);
+
+/**
+ * @brief Frees the memory held by a tag buffer and leaves it empty.
+ */
+void free_tag_buffer(TagBuffer *);
+
+/**
+ * @brief Makes sure the tag buffer can hold at least the given number of bytes without growing.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int reserve_tag_buffer(TagBuffer *, size_t);
+
+/**
+ * @brief Appends raw bytes to the tag buffer.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int append_tag_bytes(TagBuffer *, const void *, size_t);
+
+/**
+ * @brief Appends a text frame (header, encoding byte and content) to the tag buffer.
+ *
+ * @param buffer Tag buffer.
+ * @param frame_id 4 character frame ID.
+ * @param encoding Text encoding byte.
+ * @param text Frame content.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int append_text_frame(TagBuffer *, const char *, unsigned char, const char *);
+
+/**
+ * @brief Serializes the set fields of a TagData structure as text frames.
+ *
+ * @param buffer Tag buffer.
+ * @param data Fields to serialize, the unset ones are skipped.
+ * @param version ID3v2 major version of the tag, selects the frame IDs of the fields.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int serialize_tag_data(TagBuffer *, const TagData *, unsigned char);
+
+/**
+ * @brief Returns the length of the frame section of a tag body, i.e. where padding starts.
+ *
+ * @param body Tag body (the tag_size bytes following the 10 byte header) after normalize_tag_body.
+ * @param tag_size Size of the tag body.
+ * @return Number of bytes taken by the frames.
+ */
+size_t frames_length(const unsigned char *, size_t);
+
+#endif // TAG_BUILDER_H
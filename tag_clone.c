@@ -0,0 +1,144 @@
+/**
+ * @file tag_clone.c
+ * @brief Serialize-once tag cloning from a reference tag to many files.
+ */
+#include "tag_clone.h"
+#include "id3_reader.h"
+#include "id3_writer.h"
+#include "worker_pool.h"
+#include "throttle.h"
+#include "checkpoint.h"
+#include "error_handling.h"
+
+/**
+ * @brief Shared state of a clone run.
+ */
+typedef struct {
+    const unsigned char *version; /**< Version bytes for the target headers */
+    const TagBuffer *frames;      /**< Frames serialized once for all targets */
+    char **targets;               /**< Target file names */
+    int *status;                  /**< Outcome per target */
+    const char *resumed;          /**< Targets completed by an interrupted run, skipped */
+} CloneJob;
+
+/**
+ * @brief Reads the frames of a reference file, serialized as its tag version stores them.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int read_reference_frames(const char *filename, unsigned char *version, TagBuffer *frames){
+    FILE *file = fopen(filename, "rb");
+    if(!file){
+        perror("Failed to open reference file");
+        return FAILURE;
+    }
+
+    unsigned char tag_header[TAG_HEADER_SIZE];
+    if(fread(tag_header, TAG_HEADER_SIZE, 1, file) != 1 || memcmp(tag_header, "ID3", 3) != 0){
+        display_error("The reference file doesn't follow ID3v2 standard.");
+        fclose(file);
+        return FAILURE;
+    }
+
+    version[0] = tag_header[3];
+    version[1] = tag_header[4];
+    unsigned int tag_size = decode_syncsafe(&tag_header[6]);
+
+    unsigned char *body = (unsigned char *)calloc(1, tag_size ? tag_size : 1);
+    if(!body){
+        perror("Memory allocation failed");
+        fclose(file);
+        return FAILURE;
+    }
+
+    int status = FAILURE;
+    if(fread(body, 1, tag_size, file) == tag_size){
+        // The targets get the frames decoded, with the frame sizes of the reference version
+        unsigned char flags = tag_header[5];
+        normalize_tag_body(body, tag_size, version[0], &flags);
+
+        // Padding is per target, only the frames are shared
+        size_t start = frames->length;
+        status = append_tag_bytes(frames, body, frames_length(body, tag_size))
+              && encode_frame_sizes(frames->data + start, frames->length - start, version[0]);
+    }
+    else{
+        display_error("Unexpected end of file while reading the reference tag.");
+    }
+
+    free(body);
+    fclose(file);
+
+    return status;
+}
+
+/**
+ * @brief Worker task: writes the shared frames into one target.
+ */
+static void clone_task(size_t index, unsigned int worker, void *context){
+    CloneJob *job = (CloneJob *)context;
+    (void)worker;
+
+    if(job->resumed[index]){
+        return;
+    }
+
+    throttle_file();
+    job->status[index] = write_serialized_tag(job->targets[index], job->version, job->frames);
+
+    // Failed targets are tried again by a resumed run
+    if(job->status[index] != EDIT_FAILED){
+        record_completed(job->targets[index], job->status[index], NULL, 0);
+    }
+}
+
+/**
+ * @brief Writes the same serialized frames into every target file on a pool of worker threads.
+ * @return 0 if every target was written, non-zero otherwise.
+ */
+int run_tag_clone(const unsigned char *version, const TagBuffer *frames, char **targets, size_t target_count, unsigned int thread_count){
+    int *status = (int *)calloc(target_count ? target_count : 1, sizeof(int));
+    char *resumed = (char *)calloc(target_count ? target_count : 1, sizeof(char));
+    if(!status || !resumed){
+        perror("Memory allocation failed");
+        free(status);
+        free(resumed);
+        return 1;
+    }
+
+    // Targets completed by an interrupted run keep their outcome
+    for(size_t i = 0; i < target_count; i++){
+        resumed[i] = find_completed(targets[i], &status[i], NULL, NULL);
+    }
+
+    CloneJob job = {version, frames, targets, status, resumed};
+    if(run_worker_pool(target_count, thread_count, clone_task, &job) != 0){
+        free(status);
+        free(resumed);
+        return 1;
+    }
+
+    size_t in_place = 0, rewritten = 0, failed = 0;
+    for(size_t i = 0; i < target_count; i++){
+        switch(status[i]){
+            case EDIT_IN_PLACE:
+                printf("in-place\t%s\n", targets[i]);
+                in_place++;
+                break;
+            case EDIT_APPLIED:
+                printf("rewritten\t%s\n", targets[i]);
+                rewritten++;
+                break;
+            default:
+                printf("failed\t%s\n", targets[i]);
+                failed++;
+                break;
+        }
+    }
+
+    printf("Clone: %zu bytes of frames into %zu files, %zu in place, %zu rewritten, %zu failed\n", frames->length, target_count, in_place, rewritten, failed);
+
+    free(status);
+    free(resumed);
+
+    return failed ? 1 : 0;
+}
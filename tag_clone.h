@@ -0,0 +1,31 @@
+#ifndef TAG_CLONE_H
+#define TAG_CLONE_H
+
+#include "main.h"
+#include "tag_builder.h"
+
+/**
+ * @brief Reads the frames of a reference file, serialized as its tag version stores them.
+ *
+ * Unsynchronisation and the extended header of the reference are not carried over.
+ *
+ * @param filename Reference MP3 file.
+ * @param version Set to the major and revision version bytes of the reference tag.
+ * @param frames Buffer receiving the frames (without header and padding).
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int read_reference_frames(const char *, unsigned char *, TagBuffer *);
+
+/**
+ * @brief Writes the same serialized frames into every target file on a pool of worker threads.
+ *
+ * @param version Version bytes written in the target headers.
+ * @param frames Serialized frames shared by all targets.
+ * @param targets Target file names.
+ * @param target_count Number of targets.
+ * @param thread_count Number of worker threads (0 selects one per CPU).
+ * @return 0 if every target was written, non-zero otherwise.
+ */
+int run_tag_clone(const unsigned char *, const TagBuffer *, char **, size_t, unsigned int);
+
+#endif // TAG_CLONE_H
@@ -0,0 +1,516 @@
+/**
+ * @file tag_table.c
+ * @brief Column oriented storage of the tags of a whole library.
+ */
+#include "tag_table.h"
+#include "error_handling.h"
+
+/**
+ * @brief FNV-1a hash of a string.
+ */
+static uint32_t hash_string(const char *text){
+    uint32_t hash = 2166136261u;
+    for(; *text; text++){
+        hash = (hash ^ (unsigned char)*text) * 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Returns the index slot of a string, either holding its ID or empty.
+ */
+static uint32_t *find_string_slot(const StringPool *pool, const char *text){
+    uint32_t mask = pool->index_capacity - 1;
+    uint32_t slot = hash_string(text) & mask;
+
+    while(pool->index[slot] && strcmp(pool->data + pool->offsets[pool->index[slot]], text) != 0){
+        slot = (slot + 1) & mask;
+    }
+
+    return &pool->index[slot];
+}
+
+/**
+ * @brief Replaces the index of a pool by one of the given capacity (power of two), rehashing the IDs.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int resize_string_index(StringPool *pool, uint32_t capacity){
+    uint32_t *index = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+    if(!index){
+        perror("Memory allocation failed");
+        return FAILURE;
+    }
+
+    free(pool->index);
+    pool->index = index;
+    pool->index_capacity = capacity;
+
+    for(uint32_t id = 1; id < pool->count; id++){
+        *find_string_slot(pool, pool->data + pool->offsets[id]) = id;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Doubles the index of a pool, rehashing the IDs.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int grow_string_index(StringPool *pool){
+    return resize_string_index(pool, pool->index_capacity ? pool->index_capacity * 2 : 1024);
+}
+
+/**
+ * @brief Returns the ID of a string, adding it to the pool if it isn't there yet.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int intern_string(StringPool *pool, const char *text, uint32_t *id){
+    *id = 0;
+    if(!text || !*text){
+        return SUCCESS;
+    }
+
+    if(pool->count == 0){
+        // ID 0 is the missing value, it has no string
+        pool->offsets = (size_t *)calloc(256, sizeof(size_t));
+        if(!pool->offsets){
+            perror("Memory allocation failed");
+            return FAILURE;
+        }
+        pool->offset_capacity = 256;
+        pool->count = 1;
+    }
+
+    if((pool->count + 1) * 2 > pool->index_capacity && !grow_string_index(pool)){
+        return FAILURE;
+    }
+
+    uint32_t *slot = find_string_slot(pool, text);
+    if(*slot){
+        *id = *slot;
+        return SUCCESS;
+    }
+
+    size_t length = strlen(text) + 1;
+    if(pool->length + length > pool->capacity){
+        size_t capacity = pool->capacity ? pool->capacity : 4096;
+        while(pool->length + length > capacity){
+            capacity *= 2;
+        }
+
+        char *data = (char *)realloc(pool->data, capacity);
+        if(!data){
+            perror("Memory allocation failed");
+            return FAILURE;
+        }
+        pool->data = data;
+        pool->capacity = capacity;
+    }
+
+    if(pool->count == pool->offset_capacity){
+        size_t *offsets = (size_t *)realloc(pool->offsets, pool->offset_capacity * 2 * sizeof(size_t));
+        if(!offsets){
+            perror("Memory allocation failed");
+            return FAILURE;
+        }
+        pool->offsets = offsets;
+        pool->offset_capacity *= 2;
+    }
+
+    memcpy(pool->data + pool->length, text, length);
+    pool->offsets[pool->count] = pool->length;
+    pool->length += length;
+
+    *id = *slot = pool->count++;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Returns the string of an ID, NULL for ID 0.
+ */
+const char *pool_string(const StringPool *pool, uint32_t id){
+    return id ? pool->data + pool->offsets[id] : NULL;
+}
+
+/**
+ * @brief Frees the strings of a pool.
+ */
+static void free_string_pool(StringPool *pool){
+    free(pool->data);
+    free(pool->offsets);
+    free(pool->index);
+    memset(pool, 0, sizeof(StringPool));
+}
+
+/**
+ * @brief Initializes an empty table.
+ */
+void init_tag_table(TagTable *table){
+    memset(table, 0, sizeof(TagTable));
+}
+
+/**
+ * @brief Frees the columns and strings of a table.
+ */
+void free_tag_table(TagTable *table){
+    free_string_pool(&table->strings);
+    free(table->file);
+    free(table->title);
+    free(table->artist);
+    free(table->album);
+    free(table->comment);
+    free(table->genre);
+    free(table->year_text);
+    free(table->track_text);
+    free(table->year);
+    free(table->track);
+    free(table->track_total);
+    free(table->version);
+    free(table->revision);
+    free(table->flags);
+    free(table->tag_size);
+    free(table->padding);
+    free(table->art_size);
+    free(table->audio_hash);
+    init_tag_table(table);
+}
+
+/**
+ * @brief Resizes one column to the given number of rows.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int resize_column(void **column, size_t element_size, size_t capacity){
+    void *grown = realloc(*column, capacity * element_size);
+    if(!grown){
+        perror("Memory allocation failed");
+        return FAILURE;
+    }
+    *column = grown;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief One column of a table, for the code handling every column alike.
+ */
+typedef struct {
+    void **data;            /**< Address of the column pointer */
+    size_t element_size;    /**< Size of one value */
+} TableColumn;
+
+#define TAG_TABLE_COLUMNS 18
+
+/**
+ * @brief Lists the columns of a table.
+ */
+static void table_columns(TagTable *table, TableColumn columns[TAG_TABLE_COLUMNS]){
+    TableColumn list[TAG_TABLE_COLUMNS] = {
+        {(void **)&table->file, sizeof(uint32_t)},
+        {(void **)&table->title, sizeof(uint32_t)},
+        {(void **)&table->artist, sizeof(uint32_t)},
+        {(void **)&table->album, sizeof(uint32_t)},
+        {(void **)&table->comment, sizeof(uint32_t)},
+        {(void **)&table->genre, sizeof(uint32_t)},
+        {(void **)&table->year_text, sizeof(uint32_t)},
+        {(void **)&table->track_text, sizeof(uint32_t)},
+        {(void **)&table->year, sizeof(uint16_t)},
+        {(void **)&table->track, sizeof(uint16_t)},
+        {(void **)&table->track_total, sizeof(uint16_t)},
+        {(void **)&table->version, sizeof(uint8_t)},
+        {(void **)&table->revision, sizeof(uint8_t)},
+        {(void **)&table->flags, sizeof(uint8_t)},
+        {(void **)&table->tag_size, sizeof(uint32_t)},
+        {(void **)&table->padding, sizeof(uint32_t)},
+        {(void **)&table->art_size, sizeof(uint32_t)},
+        {(void **)&table->audio_hash, sizeof(uint64_t)},
+    };
+
+    memcpy(columns, list, sizeof(list));
+}
+
+/**
+ * @brief Resizes every column to the given number of rows.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int resize_columns(TagTable *table, size_t capacity){
+    TableColumn columns[TAG_TABLE_COLUMNS];
+    table_columns(table, columns);
+
+    // On failure the columns that did grow are simply larger than needed, the capacity stays as it was
+    for(int i = 0; i < TAG_TABLE_COLUMNS; i++){
+        if(!resize_column(columns[i].data, columns[i].element_size, capacity)){
+            return FAILURE;
+        }
+    }
+    table->capacity = capacity;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Makes room for one more row.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int reserve_tag_row(TagTable *table){
+    if(table->count < table->capacity){
+        return SUCCESS;
+    }
+
+    return resize_columns(table, table->capacity ? table->capacity * 2 : 1024);
+}
+
+/**
+ * @brief Returns the string ID column of a tag field, NULL for an unknown option.
+ */
+uint32_t *string_column(const TagTable *table, char option){
+    switch(option){
+        case 't': return table->title;
+        case 'a': return table->artist;
+        case 'A': return table->album;
+        case 'c': return table->comment;
+        case 'g': return table->genre;
+        case 'y': return table->year_text;
+        case 'T': return table->track_text;
+        default: return NULL;
+    }
+}
+
+/**
+ * @brief Parses a decimal number of at most 65535, 0 when the text isn't one.
+ * @return Pointer past the digits.
+ */
+static const char *parse_number(const char *text, uint16_t *value){
+    unsigned long number = 0;
+    const char *digit = text;
+
+    for(; *digit >= '0' && *digit <= '9' && number <= 0xFFFF; digit++){
+        number = number * 10 + (*digit - '0');
+    }
+
+    *value = number <= 0xFFFF ? (uint16_t)number : 0;
+    return digit;
+}
+
+/**
+ * @brief Appends a scanned file to the table.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int add_tag_row(TagTable *table, size_t file, const ScanRecord *record){
+    if(!reserve_tag_row(table)){
+        return FAILURE;
+    }
+
+    size_t row = table->count;
+    const TagData *data = record->data;
+
+    table->file[row] = (uint32_t)file;
+    table->year[row] = table->track[row] = table->track_total[row] = 0;
+    table->flags[row] = (data ? TAG_ROW_TAGGED : 0) | (record->hashed ? TAG_ROW_HASHED : 0);
+    table->version[row] = data ? record->version[0] : 0;
+    table->revision[row] = data ? record->version[1] : 0;
+    table->tag_size[row] = data ? record->tag_size : 0;
+    table->padding[row] = data ? record->tag_size - record->layout.frames_length : 0;
+    table->art_size[row] = data ? record->layout.art_size : 0;
+    table->audio_hash[row] = record->hashed ? record->audio_hash : 0;
+
+    if(!intern_string(&table->strings, data ? data->title : NULL, &table->title[row])
+       || !intern_string(&table->strings, data ? data->artist : NULL, &table->artist[row])
+       || !intern_string(&table->strings, data ? data->album : NULL, &table->album[row])
+       || !intern_string(&table->strings, data ? data->comment : NULL, &table->comment[row])
+       || !intern_string(&table->strings, data ? data->genre : NULL, &table->genre[row])
+       || !intern_string(&table->strings, data ? data->year : NULL, &table->year_text[row])
+       || !intern_string(&table->strings, data ? data->track : NULL, &table->track_text[row])){
+        return FAILURE;
+    }
+
+    if(data && data->year){
+        parse_number(data->year, &table->year[row]);
+    }
+    if(data && data->track){
+        const char *rest = parse_number(data->track, &table->track[row]);
+        if(*rest == '/'){
+            parse_number(rest + 1, &table->track_total[row]);
+        }
+    }
+
+    table->count++;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Appends all the rows of one table to another, re-interning its strings once.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int merge_tag_table(TagTable *into, const TagTable *from, size_t file_offset){
+    // Every distinct string of the source is looked up once, rows are then remapped by ID
+    uint32_t *ids = (uint32_t *)calloc(from->strings.count ? from->strings.count : 1, sizeof(uint32_t));
+    if(!ids){
+        perror("Memory allocation failed");
+        return FAILURE;
+    }
+
+    for(uint32_t id = 1; id < from->strings.count; id++){
+        if(!intern_string(&into->strings, pool_string(&from->strings, id), &ids[id])){
+            free(ids);
+            return FAILURE;
+        }
+    }
+
+    for(size_t row = 0; row < from->count; row++){
+        if(!reserve_tag_row(into)){
+            free(ids);
+            return FAILURE;
+        }
+
+        size_t target = into->count++;
+        into->file[target] = (uint32_t)(from->file[row] + file_offset);
+        into->title[target] = ids[from->title[row]];
+        into->artist[target] = ids[from->artist[row]];
+        into->album[target] = ids[from->album[row]];
+        into->comment[target] = ids[from->comment[row]];
+        into->genre[target] = ids[from->genre[row]];
+        into->year_text[target] = ids[from->year_text[row]];
+        into->track_text[target] = ids[from->track_text[row]];
+        into->year[target] = from->year[row];
+        into->track[target] = from->track[row];
+        into->track_total[target] = from->track_total[row];
+        into->version[target] = from->version[row];
+        into->revision[target] = from->revision[row];
+        into->flags[target] = from->flags[row];
+        into->tag_size[target] = from->tag_size[row];
+        into->padding[target] = from->padding[row];
+        into->art_size[target] = from->art_size[row];
+        into->audio_hash[target] = from->audio_hash[row];
+    }
+
+    free(ids);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Writes a table: its sizes, the strings of the pool, then each column as a whole.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int write_tag_table(FILE *out, const TagTable *table){
+    uint32_t string_count = table->strings.count;
+    uint64_t sizes[2] = {table->strings.length, table->count};
+
+    if(fwrite(&string_count, sizeof(string_count), 1, out) != 1 || fwrite(sizes, sizeof(sizes), 1, out) != 1
+       || fwrite(table->strings.data, 1, table->strings.length, out) != table->strings.length){
+        return FAILURE;
+    }
+
+    TableColumn columns[TAG_TABLE_COLUMNS];
+    table_columns((TagTable *)table, columns);
+    for(int i = 0; i < TAG_TABLE_COLUMNS; i++){
+        if(fwrite(*columns[i].data, columns[i].element_size, table->count, out) != table->count){
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Reads a table written by write_tag_table into an empty table.
+ * @return SUCCESS on success, FAILURE on read error or malformed data.
+ */
+int read_tag_table(FILE *in, TagTable *table){
+    uint32_t string_count;
+    uint64_t sizes[2];
+
+    if(fread(&string_count, sizeof(string_count), 1, in) != 1 || fread(sizes, sizeof(sizes), 1, in) != 1
+       || (string_count == 0) != (sizes[0] == 0) || string_count > sizes[0] + 1 || sizes[1] > UINT32_MAX){
+        return FAILURE;
+    }
+
+    StringPool *pool = &table->strings;
+    if(string_count){
+        pool->data = (char *)malloc(sizes[0]);
+        pool->offsets = (size_t *)malloc(string_count * sizeof(size_t));
+        if(!pool->data || !pool->offsets){
+            perror("Memory allocation failed");
+            return FAILURE;
+        }
+        pool->length = pool->capacity = sizes[0];
+        pool->offset_capacity = string_count;
+
+        if(fread(pool->data, 1, pool->length, in) != pool->length || pool->data[pool->length - 1] != '\0'){
+            return FAILURE;
+        }
+
+        // IDs follow the order of the strings, each one starts after the previous terminator
+        pool->count = 1;
+        for(size_t position = 0; position < pool->length; position += strlen(pool->data + position) + 1){
+            if(pool->count == string_count){
+                return FAILURE;
+            }
+            pool->offsets[pool->count++] = position;
+        }
+
+        uint32_t capacity = 1024;
+        while(capacity < (string_count + 1) * 2){
+            capacity *= 2;
+        }
+        if(pool->count != string_count || !resize_string_index(pool, capacity)){
+            return FAILURE;
+        }
+    }
+
+    size_t count = sizes[1];
+    if(!resize_columns(table, count ? count : 1)){
+        return FAILURE;
+    }
+
+    TableColumn columns[TAG_TABLE_COLUMNS];
+    table_columns(table, columns);
+    for(int i = 0; i < TAG_TABLE_COLUMNS; i++){
+        if(fread(*columns[i].data, columns[i].element_size, count, in) != count){
+            return FAILURE;
+        }
+    }
+
+    // String IDs must name strings of the pool
+    uint32_t *string_columns[] = {table->title, table->artist, table->album, table->comment, table->genre,
+                                  table->year_text, table->track_text};
+    for(int i = 0; i < 7; i++){
+        for(size_t row = 0; row < count; row++){
+            if(string_columns[i][row] && string_columns[i][row] >= pool->count){
+                return FAILURE;
+            }
+        }
+    }
+    table->count = count;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Prints one row in the same tab separated format as print_scan_record.
+ */
+void print_tag_row(FILE *out, const TagTable *table, size_t row, const char *path){
+    fputs(path, out);
+
+    if(!(table->flags[row] & TAG_ROW_TAGGED)){
+        fprintf(out, "\t-\t0");
+    }
+    else{
+        fprintf(out, "\t2.%u.%u\t%u", table->version[row], table->revision[row], table->tag_size[row]);
+    }
+
+    for(int i = 0; i < TAG_FIELD_COUNT; i++){
+        const uint32_t *column = string_column(table, tag_fields[i].option);
+        print_scan_field(out, column ? pool_string(&table->strings, column[row]) : NULL);
+    }
+
+    if(table->flags[row] & TAG_ROW_HASHED){
+        char hash_text[17];
+        format_audio_hash(table->audio_hash[row], hash_text);
+        fprintf(out, "\t%s", hash_text);
+    }
+    fputc('\n', out);
+}
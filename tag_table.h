@@ -0,0 +1,133 @@
+#ifndef TAG_TABLE_H
+#define TAG_TABLE_H
+
+#include <stdint.h>
+#include "main.h"
+#include "batch_scan.h"
+
+#define TAG_ROW_TAGGED 0x01 /**< The file has an ID3v2 tag */
+#define TAG_ROW_HASHED 0x02 /**< The audio hash column is set */
+
+/**
+ * @brief Interned strings, each distinct value is stored once and named by a 32 bit ID.
+ *
+ * ID 0 is reserved for a missing value.
+ */
+typedef struct {
+    char *data;              /**< NUL terminated strings, back to back */
+    size_t length;           /**< Bytes used in data */
+    size_t capacity;         /**< Bytes allocated for data */
+    size_t *offsets;         /**< Offset of each string in data, by ID */
+    uint32_t count;          /**< Number of IDs handed out, including the reserved 0 */
+    uint32_t offset_capacity;/**< Number of offsets allocated */
+    uint32_t *index;         /**< Open addressing table of IDs, 0 marks an empty slot */
+    uint32_t index_capacity; /**< Number of slots (power of two) */
+} StringPool;
+
+/**
+ * @brief Parsed tags of many files stored column by column.
+ *
+ * Text fields are interned string IDs, so a row takes a few dozen bytes plus the distinct
+ * strings it brings. Year and track are kept as written and also as numbers, the numbers
+ * are only keys for sorting and filtering. Tables are filled by one worker each
+ * and merged at the end; the alignment keeps the tables of different workers off the
+ * same cache lines.
+ */
+struct __attribute__((aligned(64))) TagTable {
+    StringPool strings;     /**< Values of the text columns */
+    size_t count;           /**< Number of rows */
+    size_t capacity;        /**< Number of rows allocated */
+    uint32_t *file;         /**< Index of the file in the scan list */
+    uint32_t *title;        /**< TIT2 string ID */
+    uint32_t *artist;       /**< TPE1 string ID */
+    uint32_t *album;        /**< TALB string ID */
+    uint32_t *comment;      /**< COMM string ID */
+    uint32_t *genre;        /**< TCON string ID */
+    uint32_t *year_text;    /**< Year string ID, as written in the tag */
+    uint32_t *track_text;   /**< TRCK string ID, as written in the tag */
+    uint16_t *year;         /**< Leading number of the year, 0 when missing or not a number */
+    uint16_t *track;        /**< TRCK track number, 0 when missing or not a number */
+    uint16_t *track_total;  /**< TRCK total after the '/', 0 when missing or not a number */
+    uint8_t *version;       /**< ID3v2 major version, 0 when untagged */
+    uint8_t *revision;      /**< ID3v2 revision */
+    uint8_t *flags;         /**< TAG_ROW_* bits */
+    uint32_t *tag_size;     /**< Tag size (excluding the header) */
+    uint32_t *padding;      /**< Padding bytes after the frames */
+    uint32_t *art_size;     /**< Bytes taken by APIC frames */
+    uint64_t *audio_hash;   /**< Audio payload hash when TAG_ROW_HASHED is set */
+};
+
+/**
+ * @brief Initializes an empty table.
+ */
+void init_tag_table(TagTable *);
+
+/**
+ * @brief Frees the columns and strings of a table.
+ */
+void free_tag_table(TagTable *);
+
+/**
+ * @brief Returns the ID of a string, adding it to the pool if it isn't there yet.
+ *
+ * @param pool String pool.
+ * @param text String, NULL or empty strings get ID 0.
+ * @param id Receives the ID.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int intern_string(StringPool *, const char *, uint32_t *);
+
+/**
+ * @brief Returns the string of an ID, NULL for ID 0.
+ */
+const char *pool_string(const StringPool *, uint32_t);
+
+/**
+ * @brief Returns the string ID column of a tag field, NULL for an unknown option.
+ */
+uint32_t *string_column(const TagTable *, char);
+
+/**
+ * @brief Appends a scanned file to the table.
+ *
+ * @param table Table.
+ * @param file Index of the file in the scan list.
+ * @param record Parsed tag of the file.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int add_tag_row(TagTable *, size_t, const ScanRecord *);
+
+/**
+ * @brief Appends all the rows of one table to another, re-interning its strings once.
+ *
+ * @param into Table receiving the rows.
+ * @param from Table whose rows are appended.
+ * @param file_offset Added to the file index of every appended row (tables of different file lists).
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int merge_tag_table(TagTable *, const TagTable *, size_t);
+
+/**
+ * @brief Writes a table: its sizes, the strings of the pool, then each column as a whole.
+ *
+ * Values are written in host byte order, the reader must run on the same architecture.
+ *
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+int write_tag_table(FILE *, const TagTable *);
+
+/**
+ * @brief Reads a table written by write_tag_table into an empty table.
+ *
+ * The string IDs stay as written, so rows need no re-interning until the table is merged.
+ *
+ * @return SUCCESS on success, FAILURE on read error or malformed data.
+ */
+int read_tag_table(FILE *, TagTable *);
+
+/**
+ * @brief Prints one row in the same tab separated format as print_scan_record.
+ */
+void print_tag_row(FILE *, const TagTable *, size_t, const char *);
+
+#endif // TAG_TABLE_H
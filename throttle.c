@@ -0,0 +1,368 @@
+/**
+ * @file throttle.c
+ * @brief Token bucket throttling of reads, writes and files, and I/O priority of the workers.
+ */
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "throttle.h"
+#include "error_handling.h"
+
+// ioprio_set has no libc wrapper
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_NONE 0
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+
+/**
+ * @brief Rate limiter: tokens accumulate at rate per second up to burst.
+ *
+ * A request larger than the available tokens is granted at once and leaves the bucket
+ * in debt, the caller sleeps until the debt would have been paid back.
+ */
+typedef struct {
+    double rate;    /**< Tokens per second, 0 for unlimited */
+    double tokens;  /**< Available tokens, negative when in debt */
+    double last;    /**< Time of the last refill, in seconds */
+} TokenBucket;
+
+/**
+ * @brief Throttling settings, as parsed from the environment or the control file.
+ */
+typedef struct {
+    double read_rate;   /**< Bytes read per second */
+    double write_rate;  /**< Bytes written per second */
+    double file_rate;   /**< Files per second */
+    int ioprio;         /**< ioprio_set value, -1 to leave the priority alone */
+} ThrottleSettings;
+
+static pthread_mutex_t throttle_lock = PTHREAD_MUTEX_INITIALIZER;
+static TokenBucket read_bucket, write_bucket, file_bucket;
+static int throttle_enabled;
+static const char *control_path;
+static struct timespec control_mtime;
+static double control_checked;
+static volatile sig_atomic_t reload_requested;
+// Bumped when the priority changes, each thread re-applies it when it sees a new value
+static unsigned int ioprio_generation;
+static int current_ioprio = -1;
+static __thread unsigned int thread_generation;
+
+/**
+ * @brief Returns a monotonic time in seconds.
+ */
+static double now_seconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Sleeps for a number of seconds.
+ */
+static void sleep_seconds(double seconds){
+    struct timespec delay;
+    delay.tv_sec = (time_t)seconds;
+    delay.tv_nsec = (long)((seconds - delay.tv_sec) * 1e9);
+
+    while(nanosleep(&delay, &delay) != 0);
+}
+
+/**
+ * @brief Takes tokens from a bucket.
+ * @return Seconds the caller has to wait.
+ */
+static double take_tokens(TokenBucket *bucket, double amount){
+    if(bucket->rate <= 0){
+        return 0;
+    }
+
+    double now = now_seconds();
+    double burst = bucket->rate * THROTTLE_BURST_SECONDS;
+
+    bucket->tokens += (now - bucket->last) * bucket->rate;
+    if(bucket->tokens > burst){
+        bucket->tokens = burst;
+    }
+    bucket->last = now;
+    bucket->tokens -= amount;
+
+    return bucket->tokens < 0 ? -bucket->tokens / bucket->rate : 0;
+}
+
+/**
+ * @brief Changes the rate of a bucket, keeping what it already holds.
+ */
+static void set_bucket_rate(TokenBucket *bucket, double rate){
+    if(bucket->rate <= 0){
+        bucket->tokens = 0;
+        bucket->last = now_seconds();
+    }
+    bucket->rate = rate;
+}
+
+/**
+ * @brief Parses a rate with an optional K, M or G suffix (powers of 1024).
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int parse_rate(const char *text, size_t length, double *rate){
+    char *end;
+    double value = strtod(text, &end);
+    size_t used = end - text;
+
+    if(used == 0 || value < 0){
+        return FAILURE;
+    }
+    if(used < length){
+        switch(*end){
+            case 'k': case 'K': value *= 1024; break;
+            case 'm': case 'M': value *= 1024 * 1024; break;
+            case 'g': case 'G': value *= 1024.0 * 1024 * 1024; break;
+            default: return FAILURE;
+        }
+        used++;
+    }
+
+    *rate = value;
+    return used == length ? SUCCESS : FAILURE;
+}
+
+/**
+ * @brief Parses an I/O priority class: idle, be[:level] or none.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int parse_ioprio(const char *text, size_t length, int *ioprio){
+    if(length == 4 && strncmp(text, "idle", 4) == 0){
+        *ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+        return SUCCESS;
+    }
+    if(length == 4 && strncmp(text, "none", 4) == 0){
+        *ioprio = IOPRIO_CLASS_NONE << IOPRIO_CLASS_SHIFT;
+        return SUCCESS;
+    }
+    if(length >= 2 && strncmp(text, "be", 2) == 0){
+        int level = 4;
+        if(length == 4 && text[2] == ':' && text[3] >= '0' && text[3] <= '7'){
+            level = text[3] - '0';
+        }
+        else if(length != 2){
+            return FAILURE;
+        }
+        *ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | level;
+        return SUCCESS;
+    }
+
+    return FAILURE;
+}
+
+/**
+ * @brief Parses key=value settings.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int parse_settings(const char *text, ThrottleSettings *settings){
+    settings->read_rate = settings->write_rate = settings->file_rate = 0;
+    settings->ioprio = -1;
+
+    while(*text){
+        size_t skip = strspn(text, " ,\t\r\n");
+        text += skip;
+        size_t length = strcspn(text, " ,\t\r\n");
+        if(length == 0){
+            break;
+        }
+
+        const char *equals = memchr(text, '=', length);
+        if(!equals){
+            return FAILURE;
+        }
+
+        size_t key_length = equals - text;
+        const char *value = equals + 1;
+        size_t value_length = length - key_length - 1;
+        int parsed = FAILURE;
+
+        if(key_length == 4 && strncmp(text, "read", 4) == 0){
+            parsed = parse_rate(value, value_length, &settings->read_rate);
+        }
+        else if(key_length == 5 && strncmp(text, "write", 5) == 0){
+            parsed = parse_rate(value, value_length, &settings->write_rate);
+        }
+        else if(key_length == 5 && strncmp(text, "files", 5) == 0){
+            parsed = parse_rate(value, value_length, &settings->file_rate);
+        }
+        else if(key_length == 6 && strncmp(text, "ioprio", 6) == 0){
+            parsed = parse_ioprio(value, value_length, &settings->ioprio);
+        }
+
+        if(!parsed){
+            return FAILURE;
+        }
+        text += length;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Makes a set of settings the current one.
+ */
+static void apply_settings(const ThrottleSettings *settings){
+    pthread_mutex_lock(&throttle_lock);
+
+    set_bucket_rate(&read_bucket, settings->read_rate);
+    set_bucket_rate(&write_bucket, settings->write_rate);
+    set_bucket_rate(&file_bucket, settings->file_rate);
+    if(settings->ioprio >= 0 && settings->ioprio != current_ioprio){
+        current_ioprio = settings->ioprio;
+        __atomic_add_fetch(&ioprio_generation, 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&throttle_enabled, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&throttle_lock);
+}
+
+/**
+ * @brief Reads the control file if it changed since the last time (or unconditionally).
+ */
+static void load_control_file(int force){
+    struct stat info;
+    if(stat(control_path, &info) != 0){
+        return;
+    }
+    if(!force && info.st_mtim.tv_sec == control_mtime.tv_sec && info.st_mtim.tv_nsec == control_mtime.tv_nsec){
+        return;
+    }
+    control_mtime = info.st_mtim;
+
+    FILE *file = fopen(control_path, "r");
+    if(!file){
+        return;
+    }
+
+    char text[1024];
+    size_t length = fread(text, 1, sizeof(text) - 1, file);
+    text[length] = '\0';
+    fclose(file);
+
+    ThrottleSettings settings;
+    if(parse_settings(text, &settings)){
+        apply_settings(&settings);
+    }
+    else{
+        fprintf(stderr, "Ignoring invalid throttle settings in %s\n", control_path);
+    }
+}
+
+/**
+ * @brief SIGUSR1 handler: asks for the control file to be read again.
+ */
+static void request_reload(int signal_number){
+    (void)signal_number;
+    reload_requested = 1;
+}
+
+/**
+ * @brief Configures throttling and I/O priority.
+ * @return SUCCESS on success, FAILURE if the settings can't be parsed.
+ */
+int open_throttle(const char *settings_text, const char *control_file){
+    if(settings_text && *settings_text){
+        ThrottleSettings settings;
+        if(!parse_settings(settings_text, &settings)){
+            fprintf(stderr, "Invalid throttle settings: %s\n", settings_text);
+            return FAILURE;
+        }
+        apply_settings(&settings);
+    }
+
+    if(control_file && *control_file){
+        control_path = control_file;
+        control_checked = now_seconds();
+        load_control_file(1);
+
+        // Throttling is on as soon as a control file is named, even if it is empty for now
+        __atomic_store_n(&throttle_enabled, 1, __ATOMIC_RELEASE);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = request_reload;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, NULL);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Waits on one bucket.
+ */
+static void throttle(TokenBucket *bucket, size_t amount){
+    if(!__atomic_load_n(&throttle_enabled, __ATOMIC_ACQUIRE)){
+        return;
+    }
+
+    pthread_mutex_lock(&throttle_lock);
+    double wait = take_tokens(bucket, (double)amount);
+    pthread_mutex_unlock(&throttle_lock);
+
+    if(wait > 0){
+        sleep_seconds(wait);
+    }
+}
+
+/**
+ * @brief Waits until the read budget allows the given number of bytes.
+ */
+void throttle_read(size_t bytes){
+    throttle(&read_bucket, bytes);
+}
+
+/**
+ * @brief Waits until the write budget allows the given number of bytes.
+ */
+void throttle_write(size_t bytes){
+    throttle(&write_bucket, bytes);
+}
+
+/**
+ * @brief Waits until the files per second budget allows one more file.
+ */
+void throttle_file(void){
+    if(!__atomic_load_n(&throttle_enabled, __ATOMIC_ACQUIRE)){
+        return;
+    }
+
+    if(control_path){
+        int reload = 0;
+
+        pthread_mutex_lock(&throttle_lock);
+        double now = now_seconds();
+        if(reload_requested || now - control_checked >= THROTTLE_POLL_MS / 1000.0){
+            reload = reload_requested ? 2 : 1;
+            reload_requested = 0;
+            control_checked = now;
+        }
+        pthread_mutex_unlock(&throttle_lock);
+
+        if(reload){
+            load_control_file(reload == 2);
+        }
+    }
+
+    // The priority is per thread, each worker picks up changes before its next file
+    unsigned int generation = __atomic_load_n(&ioprio_generation, __ATOMIC_ACQUIRE);
+    if(generation != thread_generation){
+        thread_generation = generation;
+        if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, __atomic_load_n(&current_ioprio, __ATOMIC_RELAXED)) != 0){
+            perror("ioprio_set");
+        }
+    }
+
+    throttle(&file_bucket, 1);
+}
@@ -0,0 +1,47 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include "main.h"
+
+// Burst allowed by each token bucket, as a fraction of a second of its rate
+#define THROTTLE_BURST_SECONDS 0.25
+// How often the control file is checked for changes, in milliseconds
+#define THROTTLE_POLL_MS 1000
+
+/**
+ * @brief Configures throttling and I/O priority.
+ *
+ * Both arguments hold settings as space, comma or newline separated key=value pairs:
+ *   read=RATE    Bytes read per second (K, M, G suffixes), 0 or absent for unlimited
+ *   write=RATE   Bytes written per second
+ *   files=N      Files processed per second
+ *   ioprio=CLASS I/O priority of the worker threads: idle, be[:0-7] or none
+ *
+ * The control file is read now, again whenever it changes and on SIGUSR1, so a running
+ * batch job can be slowed down, sped up or moved to another priority class.
+ *
+ * @param settings Initial settings (MP3TAG_THROTTLE), may be NULL.
+ * @param control_file Control file (MP3TAG_THROTTLE_FILE), may be NULL.
+ * @return SUCCESS on success, FAILURE if the settings can't be parsed.
+ */
+int open_throttle(const char *, const char *);
+
+/**
+ * @brief Waits until the read budget allows the given number of bytes.
+ */
+void throttle_read(size_t);
+
+/**
+ * @brief Waits until the write budget allows the given number of bytes.
+ */
+void throttle_write(size_t);
+
+/**
+ * @brief Waits until the files per second budget allows one more file.
+ *
+ * Called by worker tasks before each file; it also applies control file changes and
+ * the current I/O priority to the calling thread.
+ */
+void throttle_file(void);
+
+#endif // THROTTLE_H
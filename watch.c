@@ -0,0 +1,525 @@
+/**
+ * @file watch.c
+ * @brief inotify based watch mode streaming tag changes of a directory tree.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "watch.h"
+#include "batch_scan.h"
+#include "throttle.h"
+#include "error_handling.h"
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/**
+ * @brief A file with events waiting for the debounce interval to pass.
+ */
+typedef struct {
+    char *path;              /**< Path of the file */
+    long long deadline_ms;   /**< When the file is parsed again, pushed back by every new event */
+} PendingFile;
+
+/**
+ * @brief State of a watch run.
+ */
+typedef struct {
+    int inotify_fd;              /**< inotify instance */
+    char **directories;          /**< Directory path per watch descriptor */
+    size_t directory_capacity;   /**< Number of watch descriptors the array can hold */
+    PendingFile *pending;        /**< Files waiting for their deadline */
+    size_t pending_count;        /**< Number of pending files */
+    size_t pending_capacity;     /**< Number of pending files allocated */
+    size_t *index;               /**< Open addressing index into pending (slot value is position + 1) */
+    size_t index_capacity;       /**< Number of index slots (power of two) */
+    char **known;                /**< Open addressing set of the paths last streamed as present */
+    size_t known_count;          /**< Number of paths in the set */
+    size_t known_capacity;       /**< Number of set slots (power of two) */
+    unsigned int debounce_ms;    /**< Debounce interval */
+    int audio_hash;              /**< Whether records carry the audio hash */
+} WatchState;
+
+// nftw has no user data argument, so the state being filled is kept here while walking
+static WatchState *walk_state;
+static volatile sig_atomic_t stop_watching;
+
+/**
+ * @brief Signal handler: asks the event loop to stop.
+ */
+static void request_stop(int signal_number){
+    (void)signal_number;
+    stop_watching = 1;
+}
+
+/**
+ * @brief Returns a monotonic timestamp in milliseconds.
+ */
+static long long now_ms(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief FNV-1a hash of a path.
+ */
+static size_t hash_path(const char *path){
+    size_t hash = 14695981039346656037ULL;
+    for(; *path; path++){
+        hash = (hash ^ (unsigned char)*path) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Rebuilds the pending index so it has room for at least twice the pending files.
+ * @return SUCCESS on success otherwise FAILURE.
+ */
+static int rebuild_index(WatchState *state, size_t needed){
+    size_t capacity = state->index_capacity ? state->index_capacity : 64;
+    while(capacity < needed * 2){
+        capacity *= 2;
+    }
+
+    // Same size (e.g. after removing flushed files): the table is cleared and reused
+    size_t *index = state->index;
+    if(capacity == state->index_capacity){
+        memset(index, 0, capacity * sizeof(size_t));
+    }
+    else{
+        index = (size_t *)calloc(capacity, sizeof(size_t));
+        if(!index){
+            perror("Memory allocation failed");
+            return FAILURE;
+        }
+        free(state->index);
+        state->index = index;
+        state->index_capacity = capacity;
+    }
+
+    for(size_t i = 0; i < state->pending_count; i++){
+        size_t slot = hash_path(state->pending[i].path) & (capacity - 1);
+        while(index[slot]){
+            slot = (slot + 1) & (capacity - 1);
+        }
+        index[slot] = i + 1;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Marks a file as changed, coalescing with any event already pending for it.
+ */
+static void mark_pending(WatchState *state, const char *path){
+    long long deadline = now_ms() + state->debounce_ms;
+    size_t slot = 0;
+
+    if(state->index_capacity){
+        slot = hash_path(path) & (state->index_capacity - 1);
+        while(state->index[slot]){
+            PendingFile *file = &state->pending[state->index[slot] - 1];
+            if(strcmp(file->path, path) == 0){
+                file->deadline_ms = deadline;
+                return;
+            }
+            slot = (slot + 1) & (state->index_capacity - 1);
+        }
+    }
+
+    if(state->pending_count == state->pending_capacity){
+        size_t new_capacity = state->pending_capacity ? state->pending_capacity * 2 : 64;
+        PendingFile *grown = (PendingFile *)realloc(state->pending, new_capacity * sizeof(PendingFile));
+        if(!grown){
+            perror("Memory allocation failed");
+            return;
+        }
+        state->pending = grown;
+        state->pending_capacity = new_capacity;
+    }
+
+    char *copy = strdup(path);
+    if(!copy){
+        perror("Memory allocation failed");
+        return;
+    }
+    state->pending[state->pending_count].path = copy;
+    state->pending[state->pending_count++].deadline_ms = deadline;
+
+    // The lookup stopped on the empty slot of the path, the index only grows when half full
+    if(state->pending_count * 2 > state->index_capacity){
+        if(!rebuild_index(state, state->pending_count)){
+            free(state->pending[--state->pending_count].path);
+        }
+        return;
+    }
+    state->index[slot] = state->pending_count;
+}
+
+/**
+ * @brief Returns the slot of a path in the known set, or the empty slot where it would go.
+ */
+static size_t known_slot(const WatchState *state, const char *path){
+    size_t slot = hash_path(path) & (state->known_capacity - 1);
+    while(state->known[slot] && strcmp(state->known[slot], path) != 0){
+        slot = (slot + 1) & (state->known_capacity - 1);
+    }
+
+    return slot;
+}
+
+/**
+ * @brief Adds a path streamed as present to the known set.
+ */
+static void remember_known(WatchState *state, const char *path){
+    if((state->known_count + 1) * 2 > state->known_capacity){
+        size_t capacity = state->known_capacity ? state->known_capacity * 2 : 64;
+        char **known = (char **)calloc(capacity, sizeof(char *));
+        if(!known){
+            perror("Memory allocation failed");
+            return;
+        }
+
+        for(size_t i = 0; i < state->known_capacity; i++){
+            if(state->known[i]){
+                size_t slot = hash_path(state->known[i]) & (capacity - 1);
+                while(known[slot]){
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                known[slot] = state->known[i];
+            }
+        }
+        free(state->known);
+        state->known = known;
+        state->known_capacity = capacity;
+    }
+
+    size_t slot = known_slot(state, path);
+    if(!state->known[slot]){
+        state->known[slot] = strdup(path);
+        if(!state->known[slot]){
+            perror("Memory allocation failed");
+            return;
+        }
+        state->known_count++;
+    }
+}
+
+/**
+ * @brief Removes a path streamed as gone from the known set.
+ */
+static void forget_known(WatchState *state, const char *path){
+    if(!state->known_capacity){
+        return;
+    }
+
+    size_t mask = state->known_capacity - 1;
+    size_t slot = known_slot(state, path);
+    if(!state->known[slot]){
+        return;
+    }
+    free(state->known[slot]);
+    state->known[slot] = NULL;
+    state->known_count--;
+
+    // Later paths of the run move back into the hole when it lies between their home slot and them
+    for(size_t next = (slot + 1) & mask; state->known[next]; next = (next + 1) & mask){
+        size_t home = hash_path(state->known[next]) & mask;
+        if(((next - home) & mask) >= ((next - slot) & mask)){
+            state->known[slot] = state->known[next];
+            state->known[next] = NULL;
+            slot = next;
+        }
+    }
+}
+
+/**
+ * @brief Parses a file again and streams its new state.
+ */
+static void emit_file(WatchState *state, const char *path){
+    struct stat info;
+    if(stat(path, &info) != 0 || !S_ISREG(info.st_mode)){
+        printf("-\t%s\n", path);
+        forget_known(state, path);
+        return;
+    }
+
+    throttle_file();
+
+    ScanRecord record;
+    if(!scan_file(path, &record, state->audio_hash)){
+        fprintf(stderr, "Failed to read %s\n", path);
+        return;
+    }
+
+    printf("+\t");
+    print_scan_record(stdout, path, &record);
+    free_tag_data(record.data);
+    remember_known(state, path);
+}
+
+/**
+ * @brief Parses every pending file whose deadline has passed.
+ * @return Milliseconds until the next deadline, -1 when nothing is pending.
+ */
+static int flush_pending(WatchState *state){
+    long long now = now_ms();
+    long long next_deadline = -1;
+    size_t kept = 0;
+
+    for(size_t i = 0; i < state->pending_count; i++){
+        PendingFile file = state->pending[i];
+
+        if(file.deadline_ms <= now){
+            emit_file(state, file.path);
+            free(file.path);
+            continue;
+        }
+
+        if(next_deadline < 0 || file.deadline_ms < next_deadline){
+            next_deadline = file.deadline_ms;
+        }
+        state->pending[kept++] = file;
+    }
+
+    if(kept != state->pending_count){
+        state->pending_count = kept;
+        rebuild_index(state, kept);
+        fflush(stdout);
+    }
+
+    return next_deadline < 0 ? -1 : (int)(next_deadline - now);
+}
+
+/**
+ * @brief Records the directory of a watch descriptor.
+ */
+static void remember_directory(WatchState *state, int descriptor, const char *path){
+    if((size_t)descriptor >= state->directory_capacity){
+        size_t new_capacity = state->directory_capacity ? state->directory_capacity : 64;
+        while(new_capacity <= (size_t)descriptor){
+            new_capacity *= 2;
+        }
+
+        char **grown = (char **)realloc(state->directories, new_capacity * sizeof(char *));
+        if(!grown){
+            perror("Memory allocation failed");
+            return;
+        }
+        memset(grown + state->directory_capacity, 0, (new_capacity - state->directory_capacity) * sizeof(char *));
+        state->directories = grown;
+        state->directory_capacity = new_capacity;
+    }
+
+    free(state->directories[descriptor]);
+    state->directories[descriptor] = strdup(path);
+}
+
+/**
+ * @brief nftw callback: watches directories and marks MP3 files as pending.
+ */
+static int watch_entry(const char *path, const struct stat *info, int type, struct FTW *walk){
+    (void)info;
+    (void)walk;
+
+    if(type == FTW_D){
+        int descriptor = inotify_add_watch(walk_state->inotify_fd, path, WATCH_EVENTS | IN_ONLYDIR);
+        if(descriptor < 0){
+            perror(path);
+        }
+        else{
+            remember_directory(walk_state, descriptor, path);
+        }
+    }
+    else if(type == FTW_F && check_extension(path)){
+        mark_pending(walk_state, path);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Watches a directory tree and queues every MP3 file in it.
+ *
+ * Watches are added before the files are listed, so nothing written in between is missed.
+ */
+static void add_tree(WatchState *state, const char *directory){
+    walk_state = state;
+    nftw(directory, watch_entry, 64, FTW_PHYS);
+}
+
+/**
+ * @brief Whether a path is the given directory or lies below it.
+ */
+static int path_within(const char *path, const char *directory, size_t length){
+    return strncmp(path, directory, length) == 0 && (path[length] == '\0' || path[length] == '/');
+}
+
+/**
+ * @brief Stops watching a directory tree that left the watched tree.
+ *
+ * Its watches are removed, and its files are queued again so that they are streamed
+ * as gone once they no longer exist under their old path.
+ */
+static void forget_tree(WatchState *state, const char *directory){
+    size_t length = strlen(directory);
+
+    for(size_t i = 0; i < state->directory_capacity; i++){
+        if(state->directories[i] && path_within(state->directories[i], directory, length)){
+            inotify_rm_watch(state->inotify_fd, (int)i);
+            free(state->directories[i]);
+            state->directories[i] = NULL;
+        }
+    }
+
+    // Pending files under it are already queued, and fail the same check when their deadline passes
+    for(size_t i = 0; i < state->known_capacity; i++){
+        if(state->known[i] && path_within(state->known[i], directory, length)){
+            mark_pending(state, state->known[i]);
+        }
+    }
+}
+
+/**
+ * @brief Handles one inotify event.
+ */
+static void handle_event(WatchState *state, const struct inotify_event *event){
+    if(event->mask & IN_Q_OVERFLOW){
+        // Events were lost, queue every file again
+        for(size_t i = 0; i < state->directory_capacity; i++){
+            if(state->directories[i]){
+                add_tree(state, state->directories[i]);
+            }
+        }
+        return;
+    }
+
+    if(event->wd < 0 || (size_t)event->wd >= state->directory_capacity || !state->directories[event->wd]){
+        return;
+    }
+
+    if(event->mask & (IN_IGNORED | IN_DELETE_SELF)){
+        free(state->directories[event->wd]);
+        state->directories[event->wd] = NULL;
+        return;
+    }
+
+    if(event->mask & IN_MOVE_SELF){
+        // Moved away without an IN_MOVED_FROM in a watched parent (e.g. the top directory)
+        char *directory = strdup(state->directories[event->wd]);
+        if(directory){
+            forget_tree(state, directory);
+            free(directory);
+        }
+        return;
+    }
+
+    if(!event->len){
+        return;
+    }
+
+    char path[FILENAME_MAX];
+    snprintf(path, sizeof(path), "%s/%s", state->directories[event->wd], event->name);
+
+    if(event->mask & IN_ISDIR){
+        // New subdirectories (created or moved in) are watched as well, moved out ones are dropped
+        if(event->mask & (IN_CREATE | IN_MOVED_TO)){
+            add_tree(state, path);
+        }
+        else if(event->mask & IN_MOVED_FROM){
+            forget_tree(state, path);
+        }
+        return;
+    }
+
+    // IN_CREATE alone is followed by IN_CLOSE_WRITE once the file is complete
+    if(check_extension(path) && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE))){
+        mark_pending(state, path);
+    }
+}
+
+/**
+ * @brief Scans a directory tree, then keeps following it with inotify.
+ * @return 0 on a clean stop, non-zero if watching couldn't start.
+ */
+int run_watch(const char *directory, unsigned int debounce_ms, int audio_hash){
+    WatchState state;
+    memset(&state, 0, sizeof(state));
+    state.debounce_ms = debounce_ms;
+    state.audio_hash = audio_hash;
+
+    state.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(state.inotify_fd < 0){
+        perror("inotify");
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    add_tree(&state, directory);
+    if(!state.directory_capacity){
+        display_error("Nothing to watch.");
+        close(state.inotify_fd);
+        return 1;
+    }
+
+    print_scan_header(stdout, audio_hash);
+
+    // The initial scan is emitted right away, later changes wait for the debounce interval
+    for(size_t i = 0; i < state.pending_count; i++){
+        state.pending[i].deadline_ms = 0;
+    }
+
+    char events[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd poll_fd = {state.inotify_fd, POLLIN, 0};
+
+    while(!stop_watching){
+        int timeout = flush_pending(&state);
+
+        if(poll(&poll_fd, 1, timeout) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        ssize_t length;
+        while((length = read(state.inotify_fd, events, sizeof(events))) > 0){
+            for(char *cursor = events; cursor < events + length; ){
+                const struct inotify_event *event = (const struct inotify_event *)cursor;
+                handle_event(&state, event);
+                cursor += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+    fflush(stdout);
+    close(state.inotify_fd);
+    for(size_t i = 0; i < state.pending_count; i++){
+        free(state.pending[i].path);
+    }
+    for(size_t i = 0; i < state.directory_capacity; i++){
+        free(state.directories[i]);
+    }
+    for(size_t i = 0; i < state.known_capacity; i++){
+        free(state.known[i]);
+    }
+    free(state.known);
+    free(state.pending);
+    free(state.index);
+    free(state.directories);
+
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "main.h"
+
+// Quiet time after the last event of a file before it is parsed again
+#define WATCH_DEBOUNCE_MS 500
+
+/**
+ * @brief Scans a directory tree, then keeps following it with inotify.
+ *
+ * The output is a stream of lines: "+<TAB>record" when a file is found or has changed
+ * (record as printed by --scan) and "-<TAB>path" when a file went away, including the
+ * files of a directory moved out of the tree. The initial
+ * scan is streamed as "+" lines. Events of one file are coalesced until it has been
+ * quiet for debounce_ms, and only that file is parsed again. Runs until SIGINT/SIGTERM.
+ *
+ * @param directory Directory to watch (recursively).
+ * @param debounce_ms Debounce interval in milliseconds.
+ * @param audio_hash Whether records carry the audio payload hash.
+ * @return 0 on a clean stop, non-zero if watching couldn't start.
+ */
+int run_watch(const char *, unsigned int, int);
+
+#endif // WATCH_H
@@ -0,0 +1,98 @@
+/**
+ * @file worker_pool.c
+ * @brief Minimal thread pool handing out work items by index.
+ */
+#include <pthread.h>
+#include <unistd.h>
+#include "worker_pool.h"
+
+/**
+ * @brief State shared by all the workers of one pool run.
+ */
+typedef struct {
+    size_t item_count;  /**< Number of work items */
+    size_t next_item;   /**< Next item to claim (updated atomically) */
+    WorkerTask task;    /**< Task to run for each item */
+    void *context;      /**< Caller supplied context */
+} WorkerPool;
+
+/**
+ * @brief Worker thread argument.
+ */
+typedef struct {
+    WorkerPool *pool;   /**< Pool the worker belongs to */
+    unsigned int index; /**< Worker index */
+} Worker;
+
+/**
+ * @brief Returns the number of worker threads to use when none is requested.
+ */
+unsigned int default_worker_count(){
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return cpus > 0 ? (unsigned int)cpus : 1;
+}
+
+/**
+ * @brief Thread body: claims items until none are left.
+ */
+static void *worker_main(void *arg){
+    Worker *worker = (Worker *)arg;
+    WorkerPool *pool = worker->pool;
+    size_t index;
+
+    while((index = __atomic_fetch_add(&pool->next_item, 1, __ATOMIC_RELAXED)) < pool->item_count){
+        pool->task(index, worker->index, pool->context);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Runs a task over item_count work items on a pool of threads.
+ * @return 0 on success, non-zero if the threads couldn't be started.
+ */
+int run_worker_pool(size_t item_count, unsigned int thread_count, WorkerTask task, void *context){
+    if(thread_count == 0){
+        thread_count = default_worker_count();
+    }
+    if(thread_count > item_count){
+        thread_count = item_count ? (unsigned int)item_count : 1;
+    }
+
+    WorkerPool pool = {item_count, 0, task, context};
+
+    pthread_t *threads = (pthread_t *)calloc(thread_count, sizeof(pthread_t));
+    Worker *workers = (Worker *)calloc(thread_count, sizeof(Worker));
+    if(!threads || !workers){
+        perror("Memory allocation failed");
+        free(threads);
+        free(workers);
+        return 1;
+    }
+
+    unsigned int started = 0;
+    for(; started < thread_count; started++){
+        workers[started].pool = &pool;
+        workers[started].index = started;
+        if(pthread_create(&threads[started], NULL, worker_main, &workers[started]) != 0){
+            break;
+        }
+    }
+
+    // If no thread could be started, do the work on the calling thread
+    if(started == 0){
+        workers[0].pool = &pool;
+        workers[0].index = 0;
+        worker_main(&workers[0]);
+    }
+
+    for(unsigned int i = 0; i < started; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    free(workers);
+
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "main.h"
+
+/**
+ * @brief Task run by the pool for one work item.
+ *
+ * @param index Index of the work item (0 to item_count - 1).
+ * @param worker Index of the worker thread running the item (0 to thread_count - 1).
+ * @param context Caller supplied context shared by all items.
+ */
+typedef void (*WorkerTask)(size_t, unsigned int, void *);
+
+/**
+ * @brief Returns the number of worker threads to use when none is requested.
+ */
+unsigned int default_worker_count();
+
+/**
+ * @brief Runs a task over item_count work items on a pool of threads.
+ *
+ * Each worker claims the next unprocessed item from a shared atomic counter, so
+ * slow files never hold up the rest of the batch. Returns once every item is done.
+ *
+ * @param item_count Number of work items.
+ * @param thread_count Number of worker threads (0 selects the default).
+ * @param task Task to run for each item.
+ * @param context Context passed to every task call.
+ * @return 0 on success, non-zero if the threads couldn't be started.
+ */
+int run_worker_pool(size_t, unsigned int, WorkerTask, void *);
+
+#endif // WORKER_POOL_H